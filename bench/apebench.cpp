@@ -0,0 +1,133 @@
+// Times the synthesis hot paths outside the app. Each interpolation mode renders the same
+// set of sustained voices through SynthEngine::render_block, so the numbers include
+// everything a real render pays per voice-sample apart from envelope curve lookups.
+// FastMath's sine and semitone_ratio are timed against the libm calls they replace.
+//
+//   apeplayer_bench [blocks]
+
+#include "engine/synth.h"
+#include "engine/fastmath.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+static const int kVoices = 32;
+static const int kBlockSamples = 1024;
+static const int kSampleLength = 4096;
+
+static double Now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// A looping tone with some noise on top, so no mode gets to read a flat line
+static std::vector<s16> MakeSample() {
+    std::vector<s16> pcm(kSampleLength);
+    u32 seed = 1;
+    for (int i = 0; i < kSampleLength; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        double tone = std::sin(i * 6.283185307179586 * 8.0 / kSampleLength);
+        pcm[i] = (s16)(tone * 20000.0 + (int)(seed >> 20) - 2048);
+    }
+    return pcm;
+}
+
+// Voices at full sustain with pitches spread over the range songs use
+static void AddVoices(SynthEngine& spu, const std::vector<s16>& pcm) {
+    SampleView view;
+    view.pcm = pcm.data();
+    view.length = (int)pcm.size();
+    view.loop_start = 0;
+    view.loop_end = view.length;
+    view.looping = true;
+    for (int i = 0; i < kVoices; i++) {
+        SynthVoice v;
+        v.data = view;
+        v.note_base_freq = 0.5 + 2.5 * i / kVoices;
+        v.base_vol_factor = 1.0f / kVoices;
+        v.ch = i % 16;
+        v.active = true;
+        v.reverb_on = (i & 1) != 0;
+        // Fastest attack to full sustain, no sustain slope
+        v.adsr = std::make_shared<HardwareADSR>(((u32)0x1FC0 << 16) | 0x000F);
+        v.adsr->KeyOn();
+        spu.active_voices.push_back(v);
+    }
+}
+
+static void BenchInterpolation(int blocks) {
+    static const struct { Interpolation mode; const char* name; } kModes[] = {
+        { Interpolation::Linear, "linear" },
+        { Interpolation::LinearFixed, "linear-fixed" },
+        { Interpolation::Gaussian, "gaussian" },
+        { Interpolation::Sinc, "sinc" },
+    };
+    std::vector<s16> pcm = MakeSample();
+    std::vector<float> dl, dr, wl, wr;
+
+    printf("interpolation, %d voices, %d blocks of %d samples\n", kVoices, blocks, kBlockSamples);
+    for (const auto& m : kModes) {
+        SynthEngine spu;
+        spu.set_interpolation(m.mode);
+        AddVoices(spu, pcm);
+        // One block first so table setup isn't timed
+        spu.render_block(kBlockSamples, dl, dr, wl, wr);
+        u64 before = spu.voice_samples;
+
+        double start = Now();
+        for (int b = 0; b < blocks; b++) spu.render_block(kBlockSamples, dl, dr, wl, wr);
+        double seconds = Now() - start;
+
+        u64 rendered = spu.voice_samples - before;
+        printf("  %-14s %8.2f ns/voice-sample  %6.1fx realtime\n", m.name,
+               rendered ? seconds * 1e9 / rendered : 0.0,
+               seconds > 0.0 ? (double)blocks * kBlockSamples / SynthEngine::kSpuRate / seconds : 0.0);
+    }
+}
+
+// Keeps the timed loops from being optimised away
+static volatile double g_sink;
+
+// Calls f over count inputs spread across range from the origin, returns ns per call
+template <typename F>
+static double TimeCalls(F f, int count, double range) {
+    double acc = 0.0, step = range / count;
+    double start = Now();
+    for (int i = 0; i < count; i++) acc += f(i * step - range * 0.5);
+    double seconds = Now() - start;
+    g_sink = acc;
+    return seconds * 1e9 / count;
+}
+
+static void BenchFastMath(int count) {
+    // Vibrato and LFO phases run over a few turns, pitch offsets over a few octaves
+    const double kTurns = 8.0, kSemitones = 96.0;
+    auto fast_sine = [](double t) { return (double)FastMath::sine(t); };
+    auto libm_sine = [](double t) { return std::sin(t * 6.283185307179586); };
+    auto fast_ratio = [](double s) { return FastMath::semitone_ratio(s); };
+    auto libm_ratio = [](double s) { return std::pow(2.0, s / 12.0); };
+
+    double sine_error = 0.0, ratio_error = 0.0;
+    for (int i = 0; i < count; i += 97) {
+        double t = i * kTurns / count - kTurns * 0.5;
+        double s = i * kSemitones / count - kSemitones * 0.5;
+        sine_error = std::max(sine_error, std::fabs(fast_sine(t) - libm_sine(t)));
+        ratio_error = std::max(ratio_error, std::fabs(fast_ratio(s) / libm_ratio(s) - 1.0));
+    }
+
+    printf("fastmath, %d calls each\n", count);
+    printf("  sine           %8.2f ns  std::sin %8.2f ns  max abs error %.2g\n",
+           TimeCalls(fast_sine, count, kTurns), TimeCalls(libm_sine, count, kTurns), sine_error);
+    printf("  semitone_ratio %8.2f ns  std::pow %8.2f ns  max rel error %.2g\n",
+           TimeCalls(fast_ratio, count, kSemitones), TimeCalls(libm_ratio, count, kSemitones), ratio_error);
+}
+
+int main(int argc, char** argv) {
+    int blocks = argc > 1 ? std::max(1, std::atoi(argv[1])) : 2000;
+    BenchInterpolation(blocks);
+    BenchFastMath(blocks * kBlockSamples);
+    return 0;
+}
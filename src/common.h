@@ -7,6 +7,7 @@
 #include <string>
 #include <memory>
 #include <utility>
+#include <algorithm>
 
 using u8 = uint8_t;
 using s8 = int8_t;
@@ -14,6 +15,8 @@ using u16 = uint16_t;
 using s16 = int16_t;
 using u32 = uint32_t;
 using s32 = int32_t;
+using u64 = uint64_t;
+using s64 = int64_t;
 
 struct DecodedSample {
     std::vector<s16> pcm;
@@ -22,6 +25,19 @@ struct DecodedSample {
     bool looping = false;
 };
 
+// Non-owning view of a decoded sample, cheap to copy into every voice.
+struct SampleView {
+    const s16* pcm = nullptr;
+    int length = 0;
+    int loop_start = 0;
+    int loop_end = 0;
+    bool looping = false;
+
+    SampleView() = default;
+    SampleView(const DecodedSample& s)
+        : pcm(s.pcm.data()), length((int)s.pcm.size()), loop_start(s.loop_start), loop_end(s.loop_end), looping(s.looping) {}
+};
+
 struct Tone {
     u8 min_note;
     u8 max_note;
@@ -44,18 +60,68 @@ struct Tone {
     bool is_reverb() const { return (flags & 0x80) != 0; }
 };
 
+// Read-only window onto contiguous elements owned elsewhere
+template <typename T>
+struct ArrayView {
+    const T* ptr = nullptr;
+    size_t count = 0;
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T* data() const { return ptr; }
+    const T* begin() const { return ptr; }
+    const T* end() const { return ptr + count; }
+    const T& operator[](size_t i) const { return ptr[i]; }
+};
+
+// Tones that sound for one note: Program::note_tones[first .. first + count)
+struct ToneSpan {
+    u16 first = 0;
+    u16 count = 0;
+};
+
+// Notes lo .. hi, both included
+struct KeyRange {
+    int lo = 0;
+    int hi = 0;
+};
+
+// A program record in an HDBank; tones and note_tones point into the bank's shared pools
 struct Program {
-    int id;
-    u8 type;
-    u8 master_vol;
-    u8 master_pan;
-    u8 pitch_mult;
-    u8 breath_idx;
+    int id = -1;
+    u8 type = 0;
+    u8 master_vol = 0;
+    u8 master_pan = 0;
+    u8 pitch_mult = 0;
+    u8 breath_idx = 0;
 
     bool is_sfx = false;
     bool is_layered = false;  // (type & 0x80) != 0
 
-    std::vector<Tone> tones;
+    ArrayView<Tone> tones;
+
+    // Note -> tone lookup, built by HDParser at load time
+    ToneSpan note_map[128];
+    ArrayView<u16> note_tones;
+
+    const ToneSpan& tones_for(int note) const {
+        static const ToneSpan none;
+        return (note >= 0 && note < 128) ? note_map[note] : none;
+    }
+    // Runs of consecutive notes at which a tone actually sounds, lowest first. A tone shadowed
+    // in the middle of its range gets one run either side; empty if it is always shadowed.
+    std::vector<KeyRange> tone_key_runs(int tone_idx) const {
+        std::vector<KeyRange> runs;
+        for (int n = 0; n < 128; n++) {
+            const ToneSpan& span = note_map[n];
+            bool sounds = false;
+            for (int i = span.first; i < span.first + span.count && !sounds; i++) sounds = note_tones[i] == tone_idx;
+            if (!sounds) continue;
+            if (!runs.empty() && runs.back().hi == n - 1) runs.back().hi = n;
+            else runs.push_back({n, n});
+        }
+        return runs;
+    }
 };
 
 struct SQChannelInit {
@@ -1,4 +1,5 @@
 #include "adsr.h"
+#include "envcache.h"
 #include <cmath>
 #include <algorithm>
 
@@ -45,9 +46,34 @@ bool VolumeEnvelope::Tick(s16& current_level) {
 
 HardwareADSR::HardwareADSR(u32 registers) { reg_val = registers; }
 
-void HardwareADSR::KeyOn() { current_volume = 0; phase = Phase::Attack; UpdateEnvelope(); }
+void HardwareADSR::KeyOn() { current_volume = 0; phase = Phase::Attack; UpdateEnvelope(); curve = nullptr; }
 
-void HardwareADSR::KeyOff() { if (phase == Phase::Off || phase == Phase::Release) return; phase = Phase::Release; UpdateEnvelope(); }
+void HardwareADSR::KeyOn(const EnvelopeCurve* c) {
+    KeyOn();
+    if (c && !c->runs.empty()) { curve = c; curve_run = 0; curve_pos = 0; }
+}
+
+// Release only depends on the level it starts from, so leaving a curve early is exact
+void HardwareADSR::KeyOff() { if (phase == Phase::Off || phase == Phase::Release) return; curve = nullptr; phase = Phase::Release; UpdateEnvelope(); }
+
+// Consumes up to max_ticks ticks of the current curve run. Past the last run the
+// live state recorded with the curve takes over.
+u32 HardwareADSR::CurveRun(u32 max_ticks, s16& level) {
+    const EnvelopeCurve::Run& run = curve->runs[curve_run];
+    u32 n = std::min(max_ticks, run.length - curve_pos);
+    level = current_volume = run.level;
+    phase = run.phase;
+    curve_pos += n;
+    if (curve_pos == run.length) {
+        curve_pos = 0;
+        if (++curve_run == curve->runs.size()) {
+            phase = curve->end_phase; envelope = curve->end_envelope;
+            current_volume = curve->end_volume; target_volume = curve->end_target;
+            curve = nullptr;
+        }
+    }
+    return n;
+}
 
 void HardwareADSR::UpdateEnvelope() {
     u32 sustain_level = get_bits(reg_val, 0, 4); u32 decay_shift = get_bits(reg_val, 4, 4);
@@ -69,6 +95,7 @@ void HardwareADSR::UpdateEnvelope() {
 
 s16 HardwareADSR::Tick() {
     if (phase == Phase::Off) return 0;
+    if (curve) { s16 level; CurveRun(1, level); return level; }
     if (envelope.counter_increment > 0) envelope.Tick(current_volume);
     if (phase != Phase::Sustain) {
         bool reached = envelope.decreasing ? (current_volume <= target_volume) : (current_volume >= target_volume);
@@ -82,6 +109,67 @@ s16 HardwareADSR::Tick() {
     return current_volume;
 }
 
+// Number of upcoming ticks that leave both the level and the phase untouched.
+// The envelope counter only moves the level once it carries into bit 15, and the
+// increment it adds per tick is constant while the level holds still.
+u32 HardwareADSR::StableTicks(u32& increment) const {
+    increment = 0;
+    if (phase == Phase::Off) return UINT32_MAX;
+    if (phase != Phase::Sustain) {
+        bool reached = envelope.decreasing ? (current_volume <= target_volume) : (current_volume >= target_volume);
+        if (reached) return 0;
+    }
+    if (envelope.counter_increment == 0) return UINT32_MAX;
+
+    increment = envelope.counter_increment;
+    if (envelope.exponential && !envelope.decreasing && current_volume >= 0x6000) {
+        if (envelope.rate >= 44) increment >>= 2;
+        else if (envelope.rate >= 40) increment >>= 1;
+    }
+    if (increment == 0) return UINT32_MAX;
+    if (envelope.counter >= 0x8000) return 0;
+    return (0x8000 - envelope.counter + increment - 1) / increment - 1;
+}
+
+void HardwareADSR::Advance(u32 ticks) {
+    while (ticks > 0 && phase != Phase::Off) {
+        if (curve) { s16 level; ticks -= CurveRun(ticks, level); continue; }
+        u32 increment;
+        u32 stable = StableTicks(increment);
+        if (stable == 0) { Tick(); ticks--; continue; }
+        u32 run = std::min(stable, ticks);
+        envelope.counter += run * increment;
+        ticks -= run;
+    }
+}
+
+int HardwareADSR::TickBlock(s16* out, int count) {
+    int i = 0;
+    while (i < count) {
+        if (phase == Phase::Off) return i;
+        if (curve) {
+            s16 level;
+            u32 n = CurveRun((u32)(count - i), level);
+            std::fill(out + i, out + i + n, level);
+            i += n;
+            continue;
+        }
+        u32 increment;
+        u32 stable = StableTicks(increment);
+        if (stable == 0) {
+            s16 level = Tick();
+            if (phase == Phase::Off) return i;
+            out[i++] = level;
+            continue;
+        }
+        int run = (int)std::min<u32>(stable, (u32)(count - i));
+        envelope.counter += (u32)run * increment;
+        std::fill(out + i, out + i + run, current_volume);
+        i += run;
+    }
+    return count;
+}
+
 s16 HardwareADSR::calculate_timecents(u32 reg, Phase phase) {
     u32 decay_shift = (reg >> 4) & 0xF;
     u32 attack_step = (reg >> 8) & 0x3;
@@ -102,8 +190,7 @@ s16 HardwareADSR::calculate_timecents(u32 reg, Phase phase) {
     if (rate == 0) return -32768; 
     if (rate >= 0x7F) return -32768; 
 
-    double seconds = 0.001 * std::pow(2.0, (127.0 - rate) / 12.0);
-    if (seconds <= 0.0001) return -32768;
-    
-    return (s16)(1200.0 * std::log2(seconds));
+    // 1200 * log2(0.001 * 2^((127 - rate) / 12)), with the logarithm of 1 ms folded into a constant
+    static const double kMillisecondTimecents = 1200.0 * std::log2(0.001);
+    return (s16)(kMillisecondTimecents + 100.0 * (127 - rate));
 }
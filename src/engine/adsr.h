@@ -4,6 +4,8 @@
 #include "../common.h"
 #include <algorithm>
 
+struct EnvelopeCurve;
+
 class VolumeEnvelope {
 public:
     u32 counter = 0; u16 counter_increment = 0; s16 step = 0; u8 rate = 0;
@@ -14,20 +16,32 @@ public:
 
 class HardwareADSR {
 public:
-    enum class Phase { Off, Attack, Decay, Sustain, Release };
+    enum class Phase : u8 { Off, Attack, Decay, Sustain, Release };
     Phase phase = Phase::Off;
     VolumeEnvelope envelope;
     s16 current_volume = 0; s16 target_volume = 0; u32 reg_val = 0;
 
     HardwareADSR(u32 registers);
     void KeyOn();
+    // Plays back a pre-rendered curve of this register's attack/decay, then carries on live
+    void KeyOn(const EnvelopeCurve* curve);
     void KeyOff();
     void UpdateEnvelope();
     s16 Tick();
+    void Advance(u32 ticks);
+    // Same output as count Tick() calls, flat stretches filled in one step.
+    // Returns how many samples were produced before the envelope switched off.
+    int TickBlock(s16* out, int count);
+    // Ticks before the level or phase can next change, UINT32_MAX once it never will without a key event
+    u32 TicksUntilChange() const { u32 increment; return StableTicks(increment); }
 
     static s16 calculate_timecents(u32 reg, Phase phase);
 
 private:
+    const EnvelopeCurve* curve = nullptr; size_t curve_run = 0; u32 curve_pos = 0;
+
+    u32 StableTicks(u32& increment) const;
+    u32 CurveRun(u32 max_ticks, s16& level);
     u32 get_bits(u32 val, int bit, int count) const { return (val >> bit) & ((1 << count) - 1); }
 };
 
@@ -0,0 +1,399 @@
+#include "bankcache.h"
+#include "samplebank.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <type_traits>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file, unmapped when the last reference goes
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    bool open(const std::string& path);
+    const u8* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+#ifdef _WIN32
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+#endif
+    const u8* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+#ifdef _WIN32
+bool MappedFile::open(const std::string& path) {
+    m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0) return false;
+    m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_mapping) return false;
+    m_data = (const u8*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_data) return false;
+    m_size = (size_t)size.QuadPart;
+    return true;
+}
+
+MappedFile::~MappedFile() {
+    if (m_data) UnmapViewOfFile(m_data);
+    if (m_mapping) CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+}
+#else
+bool MappedFile::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) { ::close(fd); return false; }
+    void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);    // The mapping stays valid on its own
+    if (p == MAP_FAILED) return false;
+    m_data = (const u8*)p;
+    m_size = (size_t)st.st_size;
+    return true;
+}
+
+MappedFile::~MappedFile() {
+    if (m_data) munmap((void*)m_data, m_size);
+}
+#endif
+
+// File layout: header, then the sections in this order, each 16-byte aligned
+enum CacheSectionId { kPrograms, kTones, kNoteTones, kBreaths, kBreathData, kSamples, kPcm, kSectionCount };
+
+struct CacheSection {
+    u64 offset;
+    u64 bytes;
+};
+
+struct CacheHeader {
+    char magic[8];
+    u32 version;
+    u32 header_bytes;       // Record sizes, so a cache from a different layout is rejected
+    u32 program_bytes;
+    u32 tone_bytes;
+    u32 sample_bytes;
+    u32 breath_bytes;
+    u64 content_hash;
+    u64 file_bytes;
+    u32 program_count;
+    u32 tone_count;
+    u32 note_tone_count;
+    u32 breath_count;
+    u64 sample_count;
+    CacheSection sections[kSectionCount];
+};
+
+struct CachedProgram {
+    s32 id;
+    u8 type, master_vol, master_pan, pitch_mult, breath_idx, is_sfx, is_layered, pad;
+    u32 tone_first, tone_count;
+    u32 note_first, note_count;
+    ToneSpan note_map[128];
+};
+
+// Offsets are into the breath data section
+struct CachedBreath {
+    u64 script_offset;
+    u64 depth_offset;
+    u32 script_bytes;
+    u32 depth_bytes;
+};
+
+struct CachedSample {
+    u32 bd_offset;
+    u32 looping;
+    u64 pcm_first;      // In samples, into the PCM section
+    s32 length;
+    s32 loop_start;
+    s32 loop_end;
+    s32 pad;
+};
+
+static_assert(std::is_trivially_copyable<Tone>::value, "Tones are stored as raw records");
+static const char kMagic[8] = { 'A', 'P', 'E', 'B', 'A', 'N', 'K', 0 };
+static const u32 kVersion = 2;
+
+static const CacheHeader& HeaderOf(const MappedFile& map) { return *(const CacheHeader*)map.data(); }
+
+template <typename T>
+static const T* SectionOf(const MappedFile& map, int id) {
+    return (const T*)(map.data() + HeaderOf(map).sections[id].offset);
+}
+
+static u64 HashRound(u64 acc, u64 word) {
+    acc += word * 0xC2B2AE3D27D4EB4Full;
+    acc = (acc << 31) | (acc >> 33);
+    return acc * 0x9E3779B185EBCA87ull;
+}
+
+static u64 HashFinish(u64 h) {
+    h ^= h >> 33; h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33; h *= 0xC4CEB9FE1A85EC53ull;
+    return h ^ (h >> 33);
+}
+
+u64 BankCache::content_hash(const std::vector<u8>& hd_data, const std::vector<u8>& bd_data) {
+    // Every byte is read, 64-bit words at a time over four independent lanes so the multiplies
+    // overlap. It is paid on every open: about 4 GB/s, six times a byte-at-a-time FNV, so a
+    // few milliseconds for a typical BD. The lengths are mixed in so the split between the
+    // files counts.
+    u64 lanes[4] = { 0x9E3779B185EBCA87ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0x27D4EB2F165667C5ull };
+    for (const auto* file : {&hd_data, &bd_data}) {
+        const u8* p = file->data();
+        size_t n = file->size(), i = 0;
+        lanes[0] = HashRound(lanes[0], n);
+        for (; i + 32 <= n; i += 32) {
+            for (int l = 0; l < 4; l++) {
+                u64 word;
+                std::memcpy(&word, p + i + l * 8, sizeof(word));
+                lanes[l] = HashRound(lanes[l], word);
+            }
+        }
+        for (; i < n; i += 8) {
+            u64 word = 0;
+            std::memcpy(&word, p + i, std::min<size_t>(sizeof(word), n - i));
+            lanes[0] = HashRound(lanes[0], word);
+        }
+    }
+    u64 h = 0;
+    for (u64 lane : lanes) h = HashFinish(h ^ lane);
+    return h;
+}
+
+bool BankCache::write(const std::string& path, HDParser* hd, BDParser* bd, int threads) {
+    if (!hd || !bd || !hd->bank) return false;
+    const HDBank& flat = *hd->bank;
+
+    std::set<u32> offsets;
+    for (const Tone& tone : flat.tones) {
+        if (!tone.is_noise()) offsets.insert(tone.bd_offset);
+    }
+    SampleBank decoded;
+    decoded.load(hd, bd, offsets, threads);
+
+    CacheHeader header{};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.header_bytes = sizeof(CacheHeader);
+    header.program_bytes = sizeof(CachedProgram);
+    header.tone_bytes = sizeof(Tone);
+    header.sample_bytes = sizeof(CachedSample);
+    header.breath_bytes = sizeof(CachedBreath);
+    header.content_hash = content_hash(hd->getData(), bd->data);
+    header.program_count = (u32)flat.programs.size();
+    header.tone_count = (u32)flat.tones.size();
+    header.note_tone_count = (u32)flat.note_tones.size();
+    header.breath_count = (u32)hd->breath_scripts.size();
+    header.sample_count = offsets.size();
+
+    std::vector<u8> out(sizeof(CacheHeader));
+    auto add_section = [&](int id, const void* src, size_t bytes) {
+        out.resize((out.size() + 15) & ~(size_t)15);
+        header.sections[id] = { out.size(), bytes };
+        out.insert(out.end(), (const u8*)src, (const u8*)src + bytes);
+    };
+
+    std::vector<CachedProgram> programs(flat.programs.size());
+    for (size_t i = 0; i < flat.programs.size(); i++) {
+        const Program& p = flat.programs[i];
+        CachedProgram& c = programs[i];
+        c.id = p.id;
+        c.type = p.type; c.master_vol = p.master_vol; c.master_pan = p.master_pan;
+        c.pitch_mult = p.pitch_mult; c.breath_idx = p.breath_idx;
+        c.is_sfx = p.is_sfx; c.is_layered = p.is_layered;
+        c.tone_first = (u32)(p.tones.data() - flat.tones.data());
+        c.tone_count = (u32)p.tones.size();
+        c.note_first = (u32)(p.note_tones.data() - flat.note_tones.data());
+        c.note_count = (u32)p.note_tones.size();
+        std::memcpy(c.note_map, p.note_map, sizeof(c.note_map));
+    }
+    add_section(kPrograms, programs.data(), programs.size() * sizeof(CachedProgram));
+    add_section(kTones, flat.tones.data(), flat.tones.size() * sizeof(Tone));
+    add_section(kNoteTones, flat.note_tones.data(), flat.note_tones.size() * sizeof(u16));
+
+    std::vector<CachedBreath> breaths(hd->breath_scripts.size());
+    std::vector<u8> breath_data;
+    for (size_t i = 0; i < breaths.size(); i++) {
+        const auto& script = hd->breath_scripts[i];
+        static const std::vector<u8> none;
+        const auto& depth = i < hd->breath_depths.size() ? hd->breath_depths[i] : none;
+        breaths[i] = { breath_data.size(), breath_data.size() + script.size(), (u32)script.size(), (u32)depth.size() };
+        breath_data.insert(breath_data.end(), script.begin(), script.end());
+        breath_data.insert(breath_data.end(), depth.begin(), depth.end());
+    }
+    add_section(kBreaths, breaths.data(), breaths.size() * sizeof(CachedBreath));
+    add_section(kBreathData, breath_data.data(), breath_data.size());
+
+    // Slots follow the offsets in ascending order
+    std::vector<CachedSample> samples;
+    samples.reserve(offsets.size());
+    u64 pcm_total = 0;
+    int slot = 0;
+    for (u32 offset : offsets) {
+        const SampleView& s = decoded.sample(slot++);
+        // A loop start flagged after the last loop end never loops; stored as an empty loop
+        // so the cache passes its own range checks and plays the same
+        s32 loop_end = std::max(0, std::min(s.loop_end, s.length));
+        s32 loop_start = std::max(0, std::min(s.loop_start, loop_end));
+        samples.push_back({ offset, s.looping ? 1u : 0u, pcm_total, s.length, loop_start, loop_end, 0 });
+        pcm_total += (u64)s.length;
+    }
+    add_section(kSamples, samples.data(), samples.size() * sizeof(CachedSample));
+    out.reserve(((out.size() + 15) & ~(size_t)15) + pcm_total * sizeof(s16));
+    add_section(kPcm, nullptr, 0);
+    for (size_t i = 0; i < samples.size(); i++) {
+        const SampleView& s = decoded.sample((int)i);
+        out.insert(out.end(), (const u8*)s.pcm, (const u8*)(s.pcm + s.length));
+    }
+    header.sections[kPcm].bytes = pcm_total * sizeof(s16);
+
+    header.file_bytes = out.size();
+    std::memcpy(out.data(), &header, sizeof(header));
+
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp) return false;
+    bool ok = fwrite(out.data(), 1, out.size(), fp) == out.size();
+    return fclose(fp) == 0 && ok;
+}
+
+// Every count, extent and range is checked once here, so readers can index without checks
+static bool ValidCache(const MappedFile& map) {
+    if (map.size() < sizeof(CacheHeader)) return false;
+    const CacheHeader& h = HeaderOf(map);
+    if (std::memcmp(h.magic, kMagic, sizeof(kMagic)) != 0 || h.version != kVersion) return false;
+    if (h.header_bytes != sizeof(CacheHeader) || h.program_bytes != sizeof(CachedProgram) || h.tone_bytes != sizeof(Tone) ||
+        h.sample_bytes != sizeof(CachedSample) || h.breath_bytes != sizeof(CachedBreath)) return false;
+    if (h.file_bytes != map.size()) return false;
+    // Bounds the counts before they're multiplied out
+    u64 size = map.size();
+    if (h.program_count > size || h.tone_count > size || h.note_tone_count > size || h.breath_count > size || h.sample_count > size) return false;
+
+    const u64 record_bytes[kSectionCount] = {
+        (u64)h.program_count * sizeof(CachedProgram), (u64)h.tone_count * sizeof(Tone), (u64)h.note_tone_count * sizeof(u16),
+        (u64)h.breath_count * sizeof(CachedBreath), h.sections[kBreathData].bytes, h.sample_count * sizeof(CachedSample),
+        h.sections[kPcm].bytes,
+    };
+    for (int i = 0; i < kSectionCount; i++) {
+        const CacheSection& s = h.sections[i];
+        if (s.offset % 16 != 0 || s.offset < sizeof(CacheHeader) || s.offset > map.size() ||
+            s.bytes > map.size() - s.offset || s.bytes != record_bytes[i]) return false;
+    }
+
+    const CachedProgram* programs = SectionOf<CachedProgram>(map, kPrograms);
+    for (u32 i = 0; i < h.program_count; i++) {
+        const CachedProgram& p = programs[i];
+        if ((u64)p.tone_first + p.tone_count > h.tone_count || (u64)p.note_first + p.note_count > h.note_tone_count) return false;
+        const u16* notes = SectionOf<u16>(map, kNoteTones) + p.note_first;
+        for (const ToneSpan& span : p.note_map) {
+            if ((u32)span.first + span.count > p.note_count) return false;
+            for (int n = span.first; n < span.first + span.count; n++) {
+                if (notes[n] >= p.tone_count) return false;
+            }
+        }
+    }
+    const CachedBreath* breaths = SectionOf<CachedBreath>(map, kBreaths);
+    u64 breath_bytes = h.sections[kBreathData].bytes;
+    for (u32 i = 0; i < h.breath_count; i++) {
+        const CachedBreath& b = breaths[i];
+        if (b.script_offset > breath_bytes || b.script_bytes > breath_bytes - b.script_offset ||
+            b.depth_offset > breath_bytes || b.depth_bytes > breath_bytes - b.depth_offset) return false;
+    }
+    const CachedSample* samples = SectionOf<CachedSample>(map, kSamples);
+    u64 pcm_count = h.sections[kPcm].bytes / sizeof(s16);
+    for (u64 i = 0; i < h.sample_count; i++) {
+        const CachedSample& s = samples[i];
+        if (s.length < 0 || s.pcm_first > pcm_count || (u64)s.length > pcm_count - s.pcm_first) return false;
+        if (s.loop_start < 0 || s.loop_start > s.loop_end || s.loop_end > s.length) return false;
+        if (i > 0 && samples[i - 1].bd_offset >= s.bd_offset) return false;
+    }
+    return true;
+}
+
+bool BankCache::open(const std::string& path, u64 expected_hash) {
+    close();
+    auto map = std::make_shared<MappedFile>();
+    if (!map->open(path) || !ValidCache(*map)) return false;
+    if (expected_hash != 0 && HeaderOf(*map).content_hash != expected_hash) return false;
+    m_sample_count = (size_t)HeaderOf(*map).sample_count;
+    m_map = map;
+    return true;
+}
+
+void BankCache::close() {
+    m_map.reset();
+    m_sample_count = 0;
+}
+
+u64 BankCache::hash() const {
+    return m_map ? HeaderOf(*m_map).content_hash : 0;
+}
+
+void BankCache::restore(HDParser& hd) const {
+    if (!m_map) return;
+    const CacheHeader& h = HeaderOf(*m_map);
+
+    auto flat = std::make_shared<HDBank>();
+    const Tone* tones = SectionOf<Tone>(*m_map, kTones);
+    const u16* note_tones = SectionOf<u16>(*m_map, kNoteTones);
+    flat->tones.assign(tones, tones + h.tone_count);
+    flat->note_tones.assign(note_tones, note_tones + h.note_tone_count);
+    flat->programs.resize(h.program_count);
+    const CachedProgram* programs = SectionOf<CachedProgram>(*m_map, kPrograms);
+    for (u32 i = 0; i < h.program_count; i++) {
+        const CachedProgram& c = programs[i];
+        Program& p = flat->programs[i];
+        p.id = c.id;
+        p.type = c.type; p.master_vol = c.master_vol; p.master_pan = c.master_pan;
+        p.pitch_mult = c.pitch_mult; p.breath_idx = c.breath_idx;
+        p.is_sfx = c.is_sfx != 0; p.is_layered = c.is_layered != 0;
+        p.tones = { flat->tones.data() + c.tone_first, c.tone_count };
+        p.note_tones = { flat->note_tones.data() + c.note_first, c.note_count };
+        std::memcpy(p.note_map, c.note_map, sizeof(p.note_map));
+    }
+    hd.set_bank(flat);
+
+    const CachedBreath* breaths = SectionOf<CachedBreath>(*m_map, kBreaths);
+    const u8* breath_data = SectionOf<u8>(*m_map, kBreathData);
+    hd.breath_scripts.assign(h.breath_count, {});
+    hd.breath_depths.assign(h.breath_count, {});
+    for (u32 i = 0; i < h.breath_count; i++) {
+        const CachedBreath& b = breaths[i];
+        hd.breath_scripts[i].assign(breath_data + b.script_offset, breath_data + b.script_offset + b.script_bytes);
+        hd.breath_depths[i].assign(breath_data + b.depth_offset, breath_data + b.depth_offset + b.depth_bytes);
+    }
+}
+
+u32 BankCache::sample_offset(size_t i) const {
+    return SectionOf<CachedSample>(*m_map, kSamples)[i].bd_offset;
+}
+
+SampleView BankCache::sample(size_t i) const {
+    const CachedSample& c = SectionOf<CachedSample>(*m_map, kSamples)[i];
+    SampleView view;
+    view.pcm = SectionOf<s16>(*m_map, kPcm) + c.pcm_first;
+    view.length = c.length;
+    view.loop_start = c.loop_start;
+    view.loop_end = c.loop_end;
+    view.looping = c.looping != 0;
+    return view;
+}
@@ -0,0 +1,47 @@
+#ifndef BANKCACHE_H
+#define BANKCACHE_H
+
+#include "../common.h"
+#include "../format/hd.h"
+#include "../format/bd.h"
+#include <memory>
+#include <string>
+
+class MappedFile;
+
+// Pre-converted bank: an HD's program and tone tables, its breath scripts and depth curves,
+// and every sample its tones use decoded to 16-bit PCM with loop points. Sections are
+// 16-byte aligned and the file is memory mapped, so samples are read in place and opening
+// costs the same however big the bank is. Records are stored in native layout; a cache
+// from another build or machine fails the header check and is simply rebuilt.
+class BankCache {
+public:
+    static constexpr const char* kExtension = ".apebank";
+
+    // Hash of the HD and BD a cache is built from, stored in its header
+    static u64 content_hash(const std::vector<u8>& hd_data, const std::vector<u8>& bd_data);
+    // Decodes the samples on threads workers and writes the cache in one go
+    static bool write(const std::string& path, HDParser* hd, BDParser* bd, int threads);
+
+    // Maps a cache file. A non-zero expected_hash rejects caches made from other files.
+    bool open(const std::string& path, u64 expected_hash = 0);
+    void close();
+    bool is_open() const { return m_map != nullptr; }
+    u64 hash() const;
+
+    // Replaces hd's program tables and breath curves with the cached ones
+    void restore(HDParser& hd) const;
+
+    // Cached samples in ascending BD offset order
+    size_t sample_count() const { return m_sample_count; }
+    u32 sample_offset(size_t i) const;
+    SampleView sample(size_t i) const;
+    // Holds the mapping open for views that outlive this object
+    std::shared_ptr<const void> keepalive() const { return m_map; }
+
+private:
+    std::shared_ptr<const MappedFile> m_map;
+    size_t m_sample_count = 0;
+};
+
+#endif // BANKCACHE_H
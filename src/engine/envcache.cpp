@@ -0,0 +1,48 @@
+#include "envcache.h"
+#include <algorithm>
+
+const EnvelopeCurve* EnvelopeCache::get(u32 reg) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_curves.find(reg);
+    if (it != m_curves.end()) { m_hits++; return &it->second; }
+    m_misses++;
+    EnvelopeCurve& curve = m_curves[reg];
+    build(reg, curve);
+    return &curve;
+}
+
+void EnvelopeCache::build(u32 reg, EnvelopeCurve& curve) {
+    HardwareADSR adsr(reg);
+    adsr.KeyOn();
+
+    u32 total = 0;
+    while (total < kMaxSamples && curve.runs.size() < kMaxRuns) {
+        u32 stable = adsr.TicksUntilChange();
+        if (stable == UINT32_MAX) break;
+        u32 n = 1;
+        if (stable == 0) adsr.Tick();
+        else { n = std::min(stable, kMaxSamples - total); adsr.Advance(n); }
+
+        if (!curve.runs.empty() && curve.runs.back().level == adsr.current_volume && curve.runs.back().phase == adsr.phase) curve.runs.back().length += n;
+        else curve.runs.push_back({n, adsr.current_volume, adsr.phase});
+        total += n;
+    }
+    curve.runs.shrink_to_fit();
+
+    curve.end_phase = adsr.phase;
+    curve.end_envelope = adsr.envelope;
+    curve.end_volume = adsr.current_volume;
+    curve.end_target = adsr.target_volume;
+}
+
+size_t EnvelopeCache::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_curves.size();
+}
+
+size_t EnvelopeCache::memory_bytes() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t bytes = 0;
+    for (const auto& kv : m_curves) bytes += sizeof(kv) + kv.second.runs.capacity() * sizeof(EnvelopeCurve::Run);
+    return bytes;
+}
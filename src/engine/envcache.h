@@ -0,0 +1,45 @@
+#ifndef ENVCACHE_H
+#define ENVCACHE_H
+
+#include "adsr.h"
+#include <map>
+#include <mutex>
+#include <vector>
+
+// Key-on envelope of one ADSR register, run-length encoded.
+struct EnvelopeCurve {
+    struct Run { u32 length; s16 level; HardwareADSR::Phase phase; };
+    std::vector<Run> runs;
+
+    // Live state right after the last run
+    HardwareADSR::Phase end_phase = HardwareADSR::Phase::Off;
+    VolumeEnvelope end_envelope;
+    s16 end_volume = 0;
+    s16 end_target = 0;
+};
+
+// Attack/decay curves shared by every voice with the same register value.
+// Safe to use from several engines at once.
+class EnvelopeCache {
+public:
+    // Curves stop once the envelope settles or after this many samples / runs, voices then continue live
+    static constexpr u32 kMaxSamples = 44100 * 30;
+    static constexpr size_t kMaxRuns = 16384;
+
+    const EnvelopeCurve* get(u32 reg);
+
+    u64 hits() const { std::lock_guard<std::mutex> lock(m_mutex); return m_hits; }
+    u64 misses() const { std::lock_guard<std::mutex> lock(m_mutex); return m_misses; }
+    size_t size() const;
+    size_t memory_bytes() const;
+
+private:
+    static void build(u32 reg, EnvelopeCurve& curve);
+
+    mutable std::mutex m_mutex;
+    std::map<u32, EnvelopeCurve> m_curves;
+    u64 m_hits = 0;
+    u64 m_misses = 0;
+};
+
+#endif // ENVCACHE_H
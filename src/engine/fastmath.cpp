@@ -0,0 +1,21 @@
+#include "fastmath.h"
+
+const float* FastMath::sine_table() {
+    static float table[kSineSteps + 1];
+    static bool built = [] {
+        for (int i = 0; i <= kSineSteps; i++) table[i] = (float)std::sin(i * 6.283185307179586 / kSineSteps);
+        return true;
+    }();
+    (void)built;
+    return table;
+}
+
+const double* FastMath::octave_table() {
+    static double table[kOctaveSteps + 1];
+    static bool built = [] {
+        for (int i = 0; i <= kOctaveSteps; i++) table[i] = std::exp2((double)i / kOctaveSteps);
+        return true;
+    }();
+    (void)built;
+    return table;
+}
@@ -0,0 +1,49 @@
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+#include "../common.h"
+#include <cmath>
+#include <cstring>
+
+// Table-driven replacements for the sin and pow calls made per sample
+namespace FastMath {
+    constexpr int kSineSteps = 1024;     // Per turn
+    constexpr int kOctaveSteps = 1024;   // Per octave
+
+    // kSineSteps + 1 points of sin over one turn
+    const float* sine_table();
+    // kOctaveSteps + 1 points of 2^x over x in [0, 1]
+    const double* octave_table();
+
+    // sin(2 pi turns), absolute error below 5e-6
+    inline float sine(double turns) {
+        double pos = turns * kSineSteps;
+        s64 whole = (s64)pos;
+        if (pos < whole) whole--;
+        float frac = (float)(pos - whole);
+        const float* t = sine_table() + (whole & (kSineSteps - 1));
+        return t[0] + (t[1] - t[0]) * frac;
+    }
+
+    // 2^(semitones / 12), relative error below 1e-7. Ranges beyond +-100 octaves and
+    // NaN go to std::pow.
+    inline double semitone_ratio(double semitones) {
+        double octaves = semitones * (1.0 / 12.0);
+        if (!(octaves > -100.0 && octaves < 100.0)) return std::pow(2.0, octaves);
+        // Offset so the truncation floors, then split into octave and step
+        double pos = (octaves + 128.0) * kOctaveSteps;
+        u32 step = (u32)pos;
+        double frac = pos - step;
+        const double* t = octave_table() + (step & (kOctaveSteps - 1));
+        int whole = (int)(step / kOctaveSteps) - 128;
+        // 2^whole built directly from the exponent bits
+        u64 bits = (u64)(whole + 1023) << 52;
+        double scale;
+        std::memcpy(&scale, &bits, sizeof(scale));
+        return (t[0] + (t[1] - t[0]) * frac) * scale;
+    }
+
+    inline double cents_ratio(double cents) { return semitone_ratio(cents * 0.01); }
+}
+
+#endif // FASTMATH_H
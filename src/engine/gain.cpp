@@ -0,0 +1,37 @@
+#include "gain.h"
+#include <algorithm>
+#include <cmath>
+
+static void build_pan(Gain::Pan* table, PanLaw law) {
+    for (int p = 0; p < 128; p++) {
+        float pos = p / 127.0f;
+        if (law == PanLaw::Linear) {
+            table[p].left = std::min(1.0f, (127 - p) / 64.0f);
+            table[p].right = std::min(1.0f, p / 64.0f);
+        } else {
+            table[p].left = std::sqrt(1.0f - pos);
+            table[p].right = std::sqrt(pos);
+        }
+    }
+}
+
+const Gain::Pan* Gain::pan_table(PanLaw law) {
+    static Pan power[128], linear[128];
+    static bool built = (build_pan(power, PanLaw::ConstantPower), build_pan(linear, PanLaw::Linear), true);
+    (void)built;
+    return law == PanLaw::Linear ? linear : power;
+}
+
+float Gain::max_pan(PanLaw law) {
+    const Pan* table = pan_table(law);
+    float loudest = 0.0f;
+    for (int p = 0; p < 128; p++) loudest = std::max({loudest, table[p].left, table[p].right});
+    return loudest;
+}
+
+float Gain::level(int value) {
+    static float table[128];
+    static bool built = [] { for (int i = 0; i < 128; i++) table[i] = i / 127.0f; return true; }();
+    (void)built;
+    return table[std::clamp(value, 0, 127)];
+}
@@ -0,0 +1,24 @@
+#ifndef GAIN_H
+#define GAIN_H
+
+#include "../common.h"
+
+// How a voice's pan position splits it between the two outputs
+enum class PanLaw {
+    ConstantPower, // sqrt curves, equal loudness across the field
+    Linear,        // PS1 driver style balance: the far side fades out linearly, the near side stays full
+};
+
+namespace Gain {
+    struct Pan { float left, right; };
+
+    // Left/right gains for pan positions 0-127
+    const Pan* pan_table(PanLaw law);
+    // Loudest gain any pan position gives either side
+    float max_pan(PanLaw law);
+
+    // Controller value 0-127 as a 0-1 gain
+    float level(int value);
+}
+
+#endif // GAIN_H
@@ -0,0 +1,52 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+#include "../common.h"
+
+// How voices resample their PCM, selectable per render
+enum class Interpolation {
+    Linear,      // Two-point, double precision position
+    LinearFixed, // Two-point, 32.32 integer phase
+    Gaussian,    // SPU style: 4.12 pitch counter and 4-tap Gaussian table
+    Sinc,        // 16-tap polyphase windowed sinc, band-limited to the pitch; for quality exports
+};
+
+namespace Interp {
+    // 512-entry half kernel in the SPU table layout: for phase i (0-255) the taps from
+    // oldest to newest use entries 0xFF-i, 0x1FF-i, 0x100+i and i.
+    const s16* gauss_table();
+
+    // Point i/256 of the way from s0 to s1
+    inline int gaussian(const s16* g, int i, int s_1, int s0, int s1, int s2) {
+        return (g[0xFF - i] * s_1 + g[0x1FF - i] * s0 + g[0x100 + i] * s1 + g[i] * s2) >> 15;
+    }
+
+    constexpr int kSincTaps = 16;
+    constexpr int kSincPhases = 256;
+
+    // Polyphase table (kSincPhases rows of kSincTaps) whose cutoff keeps playback at this pitch
+    // from aliasing. Row p filters samples pos-7 .. pos+8 for the point p/kSincPhases past pos.
+    const float* sinc_table(double pitch);
+    // Largest sum of coefficient magnitudes over every band and phase, so the most the
+    // filter's output can exceed the samples' own peak by
+    float sinc_overshoot();
+
+    inline float sinc(const float* coefs, const float* taps) {
+        float acc = 0.0f;
+        for (int k = 0; k < kSincTaps; k++) acc += coefs[k] * taps[k];
+        return acc;
+    }
+
+    // Sample at idx, following the loop and reading silence outside the data. Once a voice
+    // has looped, the samples before loop_start are the end of the previous pass.
+    inline int tap(const SampleView& d, int idx, bool looped) {
+        if (d.looping && d.loop_end > d.loop_start) {
+            int len = d.loop_end - d.loop_start;
+            if (idx >= d.loop_end) idx = d.loop_start + (idx - d.loop_end) % len;
+            else if (looped && idx < d.loop_start) idx = d.loop_end - 1 - (d.loop_start - 1 - idx) % len;
+        }
+        return (idx >= 0 && idx < d.length) ? d.pcm[idx] : 0;
+    }
+}
+
+#endif // INTERP_H
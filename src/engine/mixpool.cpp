@@ -0,0 +1,55 @@
+#include "mixpool.h"
+
+// Polls before a worker sleeps; roughly a few microseconds
+static const int kSpinCount = 4000;
+
+MixPool::MixPool(int threads) {
+    for (int i = 1; i < threads; i++) m_threads.emplace_back(&MixPool::worker, this, i);
+}
+
+MixPool::~MixPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+        m_generation++;
+    }
+    m_wake.notify_all();
+    for (auto& t : m_threads) t.join();
+}
+
+void MixPool::run(int count, const std::function<void(int)>& job) {
+    if (count <= 1 || m_threads.empty()) {
+        for (int i = 0; i < count; i++) job(i);
+        return;
+    }
+    m_job = &job;
+    m_count = count;
+    m_pending.store(size() - 1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_generation.fetch_add(1, std::memory_order_release);
+    }
+    m_wake.notify_all();
+
+    job(0);
+    while (m_pending.load(std::memory_order_acquire) > 0) std::this_thread::yield();
+}
+
+void MixPool::worker(int index) {
+    u32 seen = 0;
+    for (;;) {
+        u32 generation = m_generation.load(std::memory_order_acquire);
+        for (int spin = 0; generation == seen && spin < kSpinCount; spin++) {
+            generation = m_generation.load(std::memory_order_acquire);
+        }
+        if (generation == seen) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_generation.load(std::memory_order_acquire) != seen; });
+            generation = m_generation.load(std::memory_order_acquire);
+        }
+        seen = generation;
+        if (m_quit.load(std::memory_order_acquire)) return;
+        if (index < m_count) (*m_job)(index);
+        m_pending.fetch_sub(1, std::memory_order_acq_rel);
+    }
+}
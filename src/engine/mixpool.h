@@ -0,0 +1,40 @@
+#ifndef MIXPOOL_H
+#define MIXPOOL_H
+
+#include "../common.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent workers for splitting each render block. run() hands a job to every worker and
+// returns once all of them finish; between blocks the workers spin briefly before sleeping,
+// so back-to-back blocks don't pay for a wake-up.
+class MixPool {
+public:
+    explicit MixPool(int threads);  // Total threads, including the one calling run()
+    ~MixPool();
+
+    MixPool(const MixPool&) = delete;
+    MixPool& operator=(const MixPool&) = delete;
+
+    int size() const { return (int)m_threads.size() + 1; }
+    // Calls job(i) for i in [0, count) with count <= size(); the caller runs job(0)
+    void run(int count, const std::function<void(int)>& job);
+
+private:
+    void worker(int index);
+
+    std::vector<std::thread> m_threads;
+    const std::function<void(int)>* m_job = nullptr;
+    int m_count = 0;
+    std::atomic<u32> m_generation{0};
+    std::atomic<int> m_pending{0};
+    std::atomic<bool> m_quit{false};
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+};
+
+#endif // MIXPOOL_H
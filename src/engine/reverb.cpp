@@ -1,5 +1,7 @@
 #include "reverb.h"
 #include <cstring>
+#include <cmath>
+#include <algorithm>
 
 ReverbEngine::ReverbEngine() { 
     ram.resize(256 * 1024, 0); 
@@ -59,3 +61,16 @@ void ReverbEngine::process(const std::vector<float>& in_l, const std::vector<flo
         current_addr = (current_addr + 1); if (current_addr > 0x3FFFE) current_addr = base_addr;
     }
 }
+
+void ReverbEngine::scale_to_rate(int sample_rate) {
+    if (sample_rate == 44100) return;
+    double scale = sample_rate / 44100.0;
+    u16* offsets[] = {
+        &regs.dAPF1, &regs.dAPF2,
+        &regs.mLSAME, &regs.mRSAME, &regs.mLCOMB1, &regs.mRCOMB1, &regs.mLCOMB2, &regs.mRCOMB2,
+        &regs.dLSAME, &regs.dRSAME, &regs.mLDIFF, &regs.mRDIFF, &regs.mLCOMB3, &regs.mRCOMB3,
+        &regs.mLCOMB4, &regs.mRCOMB4, &regs.dLDIFF, &regs.dRDIFF, &regs.mLAPF1, &regs.mRAPF1,
+        &regs.mLAPF2, &regs.mRAPF2,
+    };
+    for (u16* r : offsets) *r = (u16)std::min(std::lround(*r * scale), (long)RAM_MASK);
+}
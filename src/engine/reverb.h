@@ -31,6 +31,8 @@ public:
     ReverbRegs regs;
     ReverbEngine();
     void init_studio_large();
+    // Stretches the buffer offsets, which are in samples, for an output rate other than 44.1 kHz
+    void scale_to_rate(int sample_rate);
     void process(const std::vector<float>& in_l, const std::vector<float>& in_r, std::vector<float>& out_l, std::vector<float>& out_r);
 };
 
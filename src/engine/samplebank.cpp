@@ -0,0 +1,73 @@
+#include "samplebank.h"
+#include "audio.h"
+#include "bankcache.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+void SampleBank::clear() {
+    m_samples.clear();
+    m_views.clear();
+    m_keepalive.reset();
+    m_tone_base.clear();
+    m_tone_slots.clear();
+}
+
+void SampleBank::load(HDParser* hd, BDParser* bd, const std::set<u32>& offsets, int threads) {
+    clear();
+    if (!hd || !bd) return;
+
+    std::vector<u32> order(offsets.begin(), offsets.end());
+    m_samples.resize(order.size());
+
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        size_t i;
+        while ((i = next++) < order.size()) {
+            auto raw = bd->get_adpcm_block(order[i]);
+            if (!raw.empty()) m_samples[i] = EngineUtils::decode_adpcm(raw);
+        }
+    };
+    int extra = std::min<int>(std::max(threads, 1), (int)order.size()) - 1;
+    std::vector<std::thread> pool;
+    for (int t = 0; t < extra; t++) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+
+    m_views.assign(m_samples.begin(), m_samples.end());
+    map_tones(hd, order);
+}
+
+void SampleBank::load(const BankCache& cache, const HDParser* hd) {
+    clear();
+    if (!hd || !cache.is_open()) return;
+    std::vector<u32> order(cache.sample_count());
+    m_views.resize(order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = cache.sample_offset(i);
+        m_views[i] = cache.sample(i);
+    }
+    m_keepalive = cache.keepalive();
+    map_tones(hd, order);
+}
+
+void SampleBank::map_tones(const HDParser* hd, const std::vector<u32>& order) {
+    if (!hd->bank) return;
+    // Programs' tones sit back to back in the bank's pool, so slots follow it one to one
+    const HDBank& flat = *hd->bank;
+    m_tone_slots.reserve(flat.tones.size());
+    for (const Tone& tone : flat.tones) {
+        auto it = std::lower_bound(order.begin(), order.end(), tone.bd_offset);
+        bool found = it != order.end() && *it == tone.bd_offset;
+        m_tone_slots.push_back(found ? (int)(it - order.begin()) : -1);
+    }
+    m_tone_base.reserve(flat.programs.size() + 1);
+    for (const Program& prog : flat.programs) m_tone_base.push_back((int)(prog.tones.data() - flat.tones.data()));
+    m_tone_base.push_back((int)m_tone_slots.size());
+}
+
+size_t SampleBank::memory_bytes() const {
+    size_t bytes = m_tone_slots.size() * sizeof(int) + m_tone_base.size() * sizeof(int);
+    for (const auto& s : m_views) bytes += (size_t)s.length * sizeof(s16);
+    return bytes;
+}
@@ -0,0 +1,45 @@
+#ifndef SAMPLEBANK_H
+#define SAMPLEBANK_H
+
+#include "../common.h"
+#include "../format/hd.h"
+#include "../format/bd.h"
+#include <vector>
+#include <set>
+#include <memory>
+
+class BankCache;
+
+// Decoded samples for the BD offsets a render needs, addressed by slot index.
+// Built once before rendering and shared read-only between engines.
+class SampleBank {
+public:
+    // Decodes the given offsets in parallel and maps every HD tone that uses one of them to its slot.
+    // Slots follow the offsets in ascending order.
+    void load(HDParser* hd, BDParser* bd, const std::set<u32>& offsets, int threads);
+    // Uses a bank cache's samples in place, nothing is decoded
+    void load(const BankCache& cache, const HDParser* hd);
+    void clear();
+
+    // Slot of tone tone_idx of program prog, -1 when its sample wasn't preloaded
+    int slot(int prog, int tone_idx) const {
+        if (prog < 0 || prog + 1 >= (int)m_tone_base.size()) return -1;
+        int base = m_tone_base[prog];
+        if (tone_idx < 0 || base + tone_idx >= m_tone_base[prog + 1]) return -1;
+        return m_tone_slots[base + tone_idx];
+    }
+    const SampleView& sample(int slot) const { return m_views[slot]; }
+    size_t size() const { return m_views.size(); }
+    size_t memory_bytes() const;
+
+private:
+    void map_tones(const HDParser* hd, const std::vector<u32>& order);
+
+    std::vector<DecodedSample> m_samples;   // Decoded here, empty when the samples come from a cache
+    std::vector<SampleView> m_views;
+    std::shared_ptr<const void> m_keepalive;    // Whatever m_views point into besides m_samples
+    std::vector<int> m_tone_base;   // Per program, start in m_tone_slots (one extra entry at the end)
+    std::vector<int> m_tone_slots;
+};
+
+#endif // SAMPLEBANK_H
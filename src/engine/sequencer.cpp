@@ -0,0 +1,165 @@
+#include "sequencer.h"
+#include <algorithm>
+#include <cmath>
+
+Sequencer::Sequencer(SeqInterface* seq, SynthEngine* spu) : m_seq(seq), m_spu(spu) { reset(); }
+
+void Sequencer::reset() {
+    for (const auto& [idx, init] : m_seq->channel_inits) {
+        if (idx >= 16 || !m_spu) continue;
+        m_spu->channels[idx].prog = init.prog_idx;
+        m_spu->channels[idx].vol = init.vol;
+        m_spu->channels[idx].pan = init.pan;
+        m_spu->channels[idx].mix_version++;
+        m_spu->channels[idx].modulation = init.modulation;
+        m_spu->channels[idx].breath_rate = init.vibrato;
+        m_spu->channels[idx].lfo_depth = init.modulation / 127.0f;
+    }
+    m_cursor = m_seq->events();
+    m_has_event = false;
+    u64 bpm = m_seq->tempo_bpm > 0 ? (u64)std::lround(m_seq->tempo_bpm) : 120;
+    m_tempo.reset(m_seq->ticks_per_quarter, m_sample_rate, 60000000, std::max<u64>(bpm, 1));
+    m_pending = 0;
+    m_pending_loaded = false;
+    m_finished = false;
+    m_position = 0;
+    m_tick = 0;
+    m_loops_done = 0;
+    m_left_loop = false;
+    m_loop_exit_position = 0;
+    m_loop_start = m_cursor->clone();
+    m_loop_start_position = 0;
+    m_loop_start_tempo = m_tempo.tempo_at(0);
+}
+
+void Sequencer::set_sample_rate(int rate) {
+    m_sample_rate = rate > 0 ? rate : 44100;
+    reset();
+}
+
+int Sequencer::advance() {
+    while (m_pending == 0 && !m_finished) {
+        if (!m_has_event) {
+            if (!m_cursor->next(m_event)) { m_finished = true; break; }
+            m_has_event = true;
+        }
+        const SQEvent& ev = m_event;
+
+        if (!m_pending_loaded) {
+            m_pending_loaded = true;
+            if (ev.delta > 0) {
+                m_tick += ev.delta;
+                // Events land on the floor of their exact time, so rounding never accumulates
+                u64 due = m_tempo.sample_at(m_tick);
+                m_pending = due > m_position ? (int)std::min<u64>(due - m_position, INT32_MAX) : 0;
+                if (m_pending > 0) break;
+            }
+        }
+
+        m_pending_loaded = false;
+        if (ev.type == "end") { m_finished = true; break; }
+        if (ev.type == "loop_end") {
+            // Every pass waits out the marker's delta; the last one then plays on past it
+            bool repeat = m_loop_count <= 0 || m_loops_done + 1 < m_loop_count;
+            m_has_event = false;
+            if (!repeat) {
+                m_left_loop = true;
+                m_loop_exit_position = m_position;
+                continue;
+            }
+            // An empty loop body would spin forever
+            if (m_position == m_loop_start_position) { m_finished = true; break; }
+            m_loops_done++;
+            m_cursor = m_loop_start->clone();
+            m_tempo.set_tempo(m_tick, m_loop_start_tempo);
+            continue;
+        }
+        if (ev.type == "loop_start") {
+            m_loop_start = m_cursor->clone();
+            m_loop_start_position = m_position;
+            m_loop_start_tempo = m_tempo.tempo_at(m_tick);
+        }
+        dispatch(ev);
+        m_has_event = false;
+    }
+    return m_finished ? 0 : m_pending;
+}
+
+void Sequencer::consume(int num_samples) {
+    num_samples = std::min(num_samples, m_pending);
+    m_pending -= num_samples;
+    m_position += num_samples;
+}
+
+void Sequencer::seek(u64 target_sample) {
+    if (target_sample < m_position) {
+        if (m_spu) m_spu->reset();
+        reset();
+    }
+    while (m_position < target_sample) {
+        int avail = advance();
+        if (avail <= 0) break;
+        int n = (int)std::min<u64>((u64)avail, target_sample - m_position);
+        if (m_spu) m_spu->fast_forward(n);
+        consume(n);
+    }
+}
+
+Sequencer::Checkpoint Sequencer::checkpoint() const {
+    Checkpoint cp;
+    cp.cursor = m_cursor->clone();
+    cp.event = m_event;
+    cp.has_event = m_has_event;
+    cp.tempo = m_tempo;
+    cp.position = m_position;
+    cp.tick = m_tick;
+    cp.pending_loaded = m_pending_loaded;
+    cp.loop_start = m_loop_start->clone();
+    cp.loop_start_position = m_loop_start_position;
+    cp.loop_start_tempo = m_loop_start_tempo;
+    cp.loops_done = m_loops_done;
+    cp.left_loop = m_left_loop;
+    cp.loop_exit_position = m_loop_exit_position;
+    if (m_spu) std::copy(std::begin(m_spu->channels), std::end(m_spu->channels), std::begin(cp.channels));
+    return cp;
+}
+
+void Sequencer::restore(const Checkpoint& cp) {
+    m_cursor = cp.cursor->clone();
+    m_event = cp.event;
+    m_has_event = cp.has_event;
+    m_tempo = cp.tempo;
+    m_position = cp.position;
+    m_tick = cp.tick;
+    m_pending = 0;
+    m_pending_loaded = cp.pending_loaded;
+    m_finished = false;
+    m_loop_start = cp.loop_start->clone();
+    m_loop_start_position = cp.loop_start_position;
+    m_loop_start_tempo = cp.loop_start_tempo;
+    m_loops_done = cp.loops_done;
+    m_left_loop = cp.left_loop;
+    m_loop_exit_position = cp.loop_exit_position;
+    if (!m_spu) return;
+    std::copy(std::begin(cp.channels), std::end(cp.channels), std::begin(m_spu->channels));
+    m_spu->active_voices.clear();
+    // Keeps envelope ticks on the same output samples as a render from the start
+    m_spu->env_clock = (cp.position * SynthEngine::kSpuRate) % m_spu->sample_rate;
+}
+
+void Sequencer::dispatch(const SQEvent& ev) {
+    if (ev.type == "tempo") {
+        // Parsers give microseconds per quarter, a bare bpm is exact as 60000000 / bpm
+        if (ev.cc_val > 0) m_tempo.set_tempo(m_tick, (u64)ev.cc_val, 1);
+        else if (ev.val > 0) m_tempo.set_tempo(m_tick, 60000000, (u64)ev.val);
+        return;
+    }
+    if (!m_spu) return;
+    if (ev.type == "note") {
+        if (ev.cmd == 0x90 && ev.vel > 0) m_spu->note_on(ev.ch, ev.note, ev.vel);
+        else m_spu->note_off(ev.ch, ev.note);
+    }
+    else if (ev.type == "prog") m_spu->program_change(ev.ch, ev.val);
+    else if (ev.type == "pitch") m_spu->pitch_bend(ev.ch, ev.val);
+    else if (ev.type == "cc") m_spu->control_change(ev.ch, ev.cc_val, ev.val);
+}
@@ -0,0 +1,99 @@
+#ifndef SEQUENCER_H
+#define SEQUENCER_H
+
+#include "../common.h"
+#include "../format/sq.h"
+#include "synth.h"
+#include "tempomap.h"
+#include <memory>
+
+// Walks a sequence's events in output-sample time and feeds them to a SynthEngine.
+// The caller renders (or fast-forwards) the gaps between events. Without a synth
+// it only tracks timing, which is enough to measure positions.
+class Sequencer {
+public:
+    // Sequencer and channel state at a gap boundary. Voices are not captured, so a
+    // checkpoint only reproduces the original render when the synth was idle.
+    struct Checkpoint {
+        std::shared_ptr<const EventCursor> cursor;
+        SQEvent event{};        // Read from the cursor but not dispatched yet
+        bool has_event = false;
+        TempoMap tempo;
+        u64 position = 0;
+        u64 tick = 0;
+        bool pending_loaded = false;
+        std::shared_ptr<const EventCursor> loop_start;
+        u64 loop_start_position = 0;
+        TempoMap::Tempo loop_start_tempo;
+        int loops_done = 0;
+        bool left_loop = false;
+        u64 loop_exit_position = 0;
+        SynthEngine::ChannelState channels[16];
+    };
+
+    Sequencer(SeqInterface* seq, SynthEngine* spu);
+
+    // Applies the sequence header to the synth and rewinds to the first event.
+    void reset();
+
+    // How many times the looped section plays; after the last pass the events past
+    // loop_end play out to the end. 0 loops forever, so the caller has to bound the render.
+    void set_loop_count(int count) { m_loop_count = count; }
+    int loops_completed() const { return m_loops_done; }
+    // Whether the last pass has gone past loop_end, and the position it did so at
+    bool left_loop() const { return m_left_loop; }
+    u64 loop_exit_position() const { return m_loop_exit_position; }
+
+    // Dispatches every event that is due and returns how many samples can be
+    // rendered before the next one. Returns 0 once the sequence has ended.
+    int advance();
+    // Marks num_samples (at most the value returned by advance) as rendered.
+    void consume(int num_samples);
+
+    // Runs the sequence up to target_sample, updating channel and voice state
+    // without synthesizing audio. Seeking backwards restarts from the top.
+    void seek(u64 target_sample);
+
+    // Only valid between gaps, i.e. after consume() has used up what advance() returned.
+    Checkpoint checkpoint() const;
+    // Restores a checkpoint and drops all voices.
+    void restore(const Checkpoint& cp);
+
+    bool finished() const { return m_finished; }
+    u64 position() const { return m_position; }
+    u64 tick() const { return m_tick; }
+    // Event data read so far and in total, for progress. Loops read the same bytes again.
+    size_t bytes_read() const { return m_cursor->bytes_read(); }
+    size_t bytes_total() const { return m_cursor->bytes_total(); }
+    float samples_per_tick() const { return m_tempo.samples_per_tick(m_tick); }
+    // Tempo changes met so far, keyed by the ticks played (loops included)
+    const TempoMap& tempo_map() const { return m_tempo; }
+    // Output rate positions are counted in; match the synth's. Rewinds the sequence.
+    void set_sample_rate(int rate);
+
+private:
+    void dispatch(const SQEvent& ev);
+
+    SeqInterface* m_seq;
+    SynthEngine* m_spu;
+    std::unique_ptr<EventCursor> m_cursor;
+    SQEvent m_event{};
+    bool m_has_event = false;
+    TempoMap m_tempo;
+    int m_pending = 0;
+    bool m_pending_loaded = false;
+    bool m_finished = false;
+    u64 m_position = 0;
+    u64 m_tick = 0;
+    int m_sample_rate = 44100;
+
+    int m_loop_count = 1;
+    int m_loops_done = 0;
+    std::unique_ptr<EventCursor> m_loop_start;   // Where loop_end jumps back to
+    u64 m_loop_start_position = 0;
+    TempoMap::Tempo m_loop_start_tempo;   // Restored on the jump back
+    bool m_left_loop = false;
+    u64 m_loop_exit_position = 0;
+};
+
+#endif // SEQUENCER_H
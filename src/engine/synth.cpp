@@ -0,0 +1,456 @@
+#include "synth.h"
+#include "audio.h"
+#include <algorithm>
+#include <cmath>
+
+void SynthEngine::note_on(int ch_idx, int note, int vel) {
+    if (!hd || !bd) return;
+    ChannelState& ch = channels[ch_idx];
+    const Program* prog = hd->program(ch.prog);
+    if (!prog) return;
+
+    if (prog->is_sfx) return;
+
+    ch.lfo_phase = 0.0f;
+
+    const ToneSpan& span = prog->tones_for(note);
+    if (span.count == 0) return;
+
+    for (int s = span.first; s < span.first + span.count; s++) {
+        int tone_idx = prog->note_tones[s];
+        const Tone* target_tone = &prog->tones[tone_idx];
+        if (target_tone->is_noise()) continue;
+
+        if (target_tone->use_prog_pitch()) {
+            if (prog->pitch_mult != 0) ch.pitch_mult = (double)prog->pitch_mult;
+        } else {
+            if (target_tone->pitch_mult != 0) ch.pitch_mult = (double)target_tone->pitch_mult;
+        }
+        ch.lfo_sensitivity = ch.pitch_mult / 128.0f;
+
+        int slot = samples ? samples->slot(ch.prog, tone_idx) : -1;
+        SampleView smp;
+        if (slot >= 0) {
+            smp = samples->sample(slot);
+        } else {
+            auto it = sample_cache.find(target_tone->bd_offset);
+            if (it == sample_cache.end()) {
+                auto raw = bd->get_adpcm_block(target_tone->bd_offset);
+                it = sample_cache.emplace(target_tone->bd_offset, raw.empty() ? DecodedSample() : EngineUtils::decode_adpcm(raw)).first;
+            }
+            smp = it->second;
+        }
+        if (smp.length == 0 && !target_tone->is_noise()) continue;
+
+        double root = (target_tone->root_key > 0) ? target_tone->root_key : 60;
+        double fine = target_tone->pitch_fine / 20.0;
+        double base_pitch = std::pow(2.0, (note - (root - fine)) / 12.0);
+
+        u32 reg_combined = ((u32)target_tone->adsr2 << 16) | (u32)target_tone->adsr1;
+        auto adsr = std::make_shared<HardwareADSR>(reg_combined);
+        if (envelopes) adsr->KeyOn(envelopes->get(reg_combined));
+        else adsr->KeyOn();
+
+        SynthVoice v;
+        v.data = smp; v.pos = 0.0; v.note_base_freq = base_pitch * ((double)kSpuRate / sample_rate);
+        v.base_pitch_mult = 1.0; v.target_pitch_mult = 1.0; v.noise_mode = target_tone->is_noise();
+
+        if (ch.portamento_active && ch.last_note_pitch > 0.0) {
+            v.base_pitch_mult = ch.last_note_pitch / v.note_base_freq;
+            v.sliding = true;
+            float slide_time = 0.01f + (ch.portamento_time / 127.0f);
+            float num_samples = slide_time * (float)sample_rate;
+            if (num_samples < 1.0f) num_samples = 1.0f;
+            v.portamento_step = std::pow(v.target_pitch_mult / v.base_pitch_mult, 1.0 / num_samples);
+        } else {
+            v.sliding = false; v.portamento_step = 1.0;
+        }
+        ch.last_note_pitch = v.note_base_freq * v.target_pitch_mult;
+
+        if (target_tone->use_modulation()) {
+            int breath_idx = -1;
+            if (target_tone->use_prog_breath()) breath_idx = prog->breath_idx; else breath_idx = target_tone->breath_idx;
+
+            const float max_vibrato_depth_semitones = 0.5f; // modest depth
+            float depth_norm = ch.modulation / 127.0f;
+            v.vibrato.depth = depth_norm * max_vibrato_depth_semitones;
+
+            const std::vector<u8>* depth_wave = nullptr;
+            if (breath_idx != 0xFF && breath_idx != 0x7F && breath_idx < (int)hd->breath_depths.size()) {
+                depth_wave = &hd->breath_depths[breath_idx];
+            }
+
+            v.vibrato.init(nullptr, depth_wave, 0, 0);
+            v.vibrato_enabled = v.vibrato.active && v.vibrato.depth > 0.0f;
+
+            if (v.vibrato_enabled) {
+                float rate_factor = (ch.breath_rate > 0 ? ch.breath_rate : 64) / 127.0f;
+                double target_hz = 0.5 + (rate_factor * 9.5);
+
+                u32 wave_size = v.vibrato.lfo_size;
+                u32 depth_size = v.vibrato.depth_size ? v.vibrato.depth_size : wave_size;
+                v.vibrato_step = (u64)((double)wave_size * target_hz / sample_rate * 4294967296.0);
+                v.vibrato_depth_step = (u64)((double)depth_size * target_hz / sample_rate * 4294967296.0);
+            }
+        }
+
+        v.tone_pan = Util::clamp_pan(target_tone->pan + (int)prog->master_pan - 64);
+        v.base_vol_factor = (target_tone->vol / 127.0f) * (prog->master_vol / 127.0f) * (vel / 127.0f);
+        v.ch = ch_idx; v.note_key = note; v.active = true; v.reverb_on = target_tone->is_reverb(); v.adsr = adsr;
+        update_gains(v);
+
+        active_voices.push_back(v);
+    }
+}
+
+void SynthEngine::note_off(int ch_idx, int note) {
+    for (auto& v : active_voices) {
+        if (v.ch == ch_idx && v.note_key == note) {
+            if (channels[ch_idx].sustain_active) v.release_pending = true;
+            else v.adsr->KeyOff();
+        }
+    }
+}
+
+void SynthEngine::pitch_bend(int ch_idx, int val) {
+    double mult = channels[ch_idx].pitch_mult;
+    channels[ch_idx].pitch_bend_factor = FastMath::semitone_ratio(((val - 64) / 64.0) * mult);
+}
+
+void SynthEngine::control_change(int ch_idx, int cc, int val) {
+    ChannelState& ch = channels[ch_idx];
+    switch(cc) {
+        case 7: ch.vol = val; ch.mix_version++; break;
+        case 11: ch.expr = val; ch.mix_version++; break;
+        case 10: ch.pan = val; ch.mix_version++; break;
+        case 91: ch.reverb_depth = val; ch.mix_version++; break;
+        case 1: ch.modulation = val; ch.lfo_depth = val/127.0f; break;
+        case 64: ch.sustain_active = (val >= 64);
+        if(!ch.sustain_active) {
+            for(auto& v : active_voices) if(v.ch == ch_idx && v.release_pending) v.adsr->KeyOff();
+        }
+        break;
+        case 65: ch.portamento_active = (val >= 64); break;
+        case 5: ch.portamento_time = val; break;
+        case 121: ch.reset_controllers(); break;
+    }
+}
+
+void SynthEngine::update_gains(SynthVoice& v) {
+    const ChannelState& ch = channels[v.ch];
+    float vol = v.base_vol_factor * Gain::level(ch.vol) * Gain::level(ch.expr);
+    const Gain::Pan& pan = Gain::pan_table(pan_law)[Util::clamp_pan(v.tone_pan + (ch.pan - 64))];
+    v.gain_l = vol * pan.left;
+    v.gain_r = vol * pan.right;
+    v.send = v.reverb_on ? vol * Gain::level(ch.reverb_depth) * 0.707f : 0.0f;
+    v.mix_version = ch.mix_version;
+}
+
+void SynthEngine::set_mix_threads(int threads) {
+    if (threads > 1) {
+        if (!mix_pool || mix_pool->size() != threads) mix_pool = std::make_unique<MixPool>(threads);
+    } else {
+        mix_pool.reset();
+    }
+}
+
+void SynthEngine::render_block(int num_samples, std::vector<float>& dl, std::vector<float>& dr, std::vector<float>& wl, std::vector<float>& wr) {
+    dl.assign(num_samples, 0.0f); dr.assign(num_samples, 0.0f);
+    wl.assign(num_samples, 0.0f); wr.assign(num_samples, 0.0f);
+
+    active_voices.erase(std::remove_if(active_voices.begin(), active_voices.end(), [](const SynthVoice& v) { return !v.active; }), active_voices.end());
+
+    // Envelopes are independent of everything else in the voice, so run them a block at a time.
+    // They tick at the SPU rate; at other output rates each sample takes the latest tick's level.
+    env_buf.resize(active_voices.size() * num_samples);
+    env_len.resize(active_voices.size());
+    if (sample_rate == kSpuRate) {
+        for (size_t vi = 0; vi < active_voices.size(); vi++) {
+            env_len[vi] = active_voices[vi].adsr->TickBlock(env_buf.data() + vi * num_samples, num_samples);
+        }
+    } else {
+        u64 clock_end = env_clock + (u64)num_samples * kSpuRate;
+        env_ticks.resize((size_t)(clock_end / sample_rate));
+        for (size_t vi = 0; vi < active_voices.size(); vi++) {
+            HardwareADSR& adsr = *active_voices[vi].adsr;
+            s16 level = adsr.current_volume;
+            int ticked = adsr.TickBlock(env_ticks.data(), (int)env_ticks.size());
+            s16* out = env_buf.data() + vi * num_samples;
+            env_len[vi] = num_samples;
+            for (int i = 0; i < num_samples; i++) {
+                int t = (int)((env_clock + (u64)(i + 1) * kSpuRate) / sample_rate);
+                if (t > ticked) { env_len[vi] = i; break; }
+                if (t > 0) level = env_ticks[t - 1];
+                out[i] = level;
+            }
+        }
+        env_clock = clock_end % sample_rate;
+    }
+
+    // Voices too quiet to hear this block keep their position moving but skip interpolation
+    // and mixing. A releasing voice is retired only when it could never be heard again: its
+    // envelope only falls from here, its tone and velocity scaling is fixed, and the bound
+    // assumes the loudest the channel's volume, expression, pan and reverb send can go.
+    for (auto& v : active_voices) {
+        if (v.mix_version != channels[v.ch].mix_version) update_gains(v);
+    }
+
+    env_cull.assign(active_voices.size(), 0);
+    if (cull_threshold > 0.0f) {
+        // Gaussian taps sum under unity; sinc can ring past the samples' peak
+        float headroom = interpolation == Interpolation::Sinc ? Interp::sinc_overshoot() : 1.0f;
+        // Volume, expression and reverb depth top out at 1; the send's 0.707 is under any pan peak
+        float loudest = Gain::max_pan(pan_law);
+        for (size_t vi = 0; vi < active_voices.size(); vi++) {
+            const SynthVoice& v = active_voices[vi];
+            const s16* env = env_buf.data() + vi * num_samples;
+            int peak = 0;
+            for (int i = 0; i < env_len[vi]; i++) peak = std::max<int>(peak, env[i]);
+            float reach = (peak / 32767.0f) * headroom;
+            if (reach * std::fabs(v.base_vol_factor) * loudest < cull_threshold && v.adsr->phase == HardwareADSR::Phase::Release) {
+                culled_samples += env_len[vi];
+                voices_retired++;
+                env_len[vi] = 0;
+            } else if (reach * std::max({std::fabs(v.gain_l), std::fabs(v.gain_r), std::fabs(v.send)}) < cull_threshold) {
+                env_cull[vi] = 1;
+            }
+        }
+    }
+
+    // Channel LFOs and the noise generator are shared state, so step them here for the whole
+    // block; after that every voice renders independently.
+    lfo_buf.resize((size_t)16 * num_samples);
+    for (int c = 0; c < 16; c++) {
+        ChannelState& ch = channels[c];
+        lfo_on[c] = ch.lfo_enabled && ch.lfo_depth > 0.0001f;
+        if (!lfo_on[c]) continue;
+        double* out = lfo_buf.data() + (size_t)c * num_samples;
+        for (int i = 0; i < num_samples; i++) out[i] = ch.get_lfo_ratio((float)sample_rate);
+    }
+    noise_buf.clear();
+    for (const auto& v : active_voices) {
+        if (!v.noise_mode) continue;
+        noise_buf.resize(num_samples);
+        for (int i = 0; i < num_samples; i++) noise_buf[i] = noise.next();
+        break;
+    }
+
+    // With a pool, dense blocks split their voices into contiguous groups of kVoicesPerGroup,
+    // each mixed into its own buffers and summed in group order afterwards. The pool's threads
+    // take groups in turn, so any thread count above one gives the same output.
+    int groups = mix_pool ? ((int)active_voices.size() + kVoicesPerGroup - 1) / kVoicesPerGroup : 1;
+    if (groups <= 1) {
+        for (size_t vi = 0; vi < active_voices.size(); vi++) {
+            render_voice(vi, num_samples, dl.data(), dr.data(), wl.data(), wr.data(), voice_samples, culled_samples);
+        }
+        return;
+    }
+
+    sub_mixes.resize(groups);
+    size_t voice_count = active_voices.size();
+    auto mix_group = [&](int g) {
+        SubMix& sub = sub_mixes[g];
+        sub.rendered = sub.culled = 0;
+        float *sl = dl.data(), *sr = dr.data(), *swl = wl.data(), *swr = wr.data();
+        if (g > 0) {
+            sub.dl.assign(num_samples, 0.0f); sub.dr.assign(num_samples, 0.0f);
+            sub.wl.assign(num_samples, 0.0f); sub.wr.assign(num_samples, 0.0f);
+            sl = sub.dl.data(); sr = sub.dr.data(); swl = sub.wl.data(); swr = sub.wr.data();
+        }
+        size_t first = (size_t)g * kVoicesPerGroup, last = std::min(first + kVoicesPerGroup, voice_count);
+        for (size_t vi = first; vi < last; vi++) render_voice(vi, num_samples, sl, sr, swl, swr, sub.rendered, sub.culled);
+    };
+    int workers = std::min(mix_pool->size(), groups);
+    mix_pool->run(workers, [&](int w) {
+        for (int g = w; g < groups; g += workers) mix_group(g);
+    });
+    for (int g = 0; g < groups; g++) {
+        const SubMix& sub = sub_mixes[g];
+        voice_samples += sub.rendered;
+        culled_samples += sub.culled;
+        if (g == 0) continue;
+        for (int i = 0; i < num_samples; i++) {
+            dl[i] += sub.dl[i]; dr[i] += sub.dr[i];
+            wl[i] += sub.wl[i]; wr[i] += sub.wr[i];
+        }
+    }
+}
+
+void SynthEngine::render_voice(size_t vi, int num_samples, float* dl, float* dr, float* wl, float* wr, u64& rendered, u64& culled_count) {
+    SynthVoice& v = active_voices[vi];
+    const ChannelState& ch = channels[v.ch];
+    const s16* env = env_buf.data() + vi * num_samples;
+    const double* lfo = lfo_on[v.ch] ? lfo_buf.data() + (size_t)v.ch * num_samples : nullptr;
+    const s16* gauss = Interp::gauss_table();
+    const float kAmpScale = 1.0f / (32768.0f * 32767.0f);   // Sample and envelope to full scale
+    bool culled = env_cull[vi];
+
+    for (int i = 0; i < num_samples; i++) {
+        if (i >= env_len[vi]) { v.active = false; return; }
+        s16 adsr_vol = env[i];
+
+        if (v.sliding) {
+            v.base_pitch_mult *= v.portamento_step;
+            if ((v.portamento_step > 1.0 && v.base_pitch_mult >= v.target_pitch_mult) ||
+                (v.portamento_step < 1.0 && v.base_pitch_mult <= v.target_pitch_mult)) {
+                v.base_pitch_mult = v.target_pitch_mult;
+                v.sliding = false;
+            }
+        }
+
+        float vibrato_pitch_offset = 0.0f;
+        if (v.vibrato_enabled) {
+            v.vibrato.tick(v.vibrato_step, v.vibrato_depth_step);
+            vibrato_pitch_offset = v.vibrato.get_pitch_offset();
+        }
+
+        double vib_factor = FastMath::semitone_ratio(vibrato_pitch_offset);
+        if (std::isnan(vib_factor) || std::isinf(vib_factor)) vib_factor = 1.0;
+
+        double effective_pitch = v.note_base_freq * v.base_pitch_mult * vib_factor * ch.pitch_bend_factor * (lfo ? lfo[i] : 1.0);
+        if (effective_pitch < 0.0) effective_pitch = 0.0;
+
+        float samp_val = 0.0f;
+
+        if (v.noise_mode) {
+            v.pos += effective_pitch;
+            if (v.pos >= 1.0) v.pos -= 1.0;
+            samp_val = (float)noise_buf[i];
+        } else if (interpolation == Interpolation::Linear) {
+            if (!culled) {
+                int pos_i = (int)v.pos; double frac = v.pos - pos_i;
+                s16 s0 = 0, s1 = 0;
+                if (pos_i < v.data.length) s0 = v.data.pcm[pos_i];
+                int next_pos = v.data.looping && v.data.loop_end > v.data.loop_start
+                ? (pos_i + 1 >= v.data.loop_end ? v.data.loop_start + (pos_i + 1 - v.data.loop_end) : pos_i + 1) : pos_i + 1;
+                if (next_pos < v.data.length) s1 = v.data.pcm[next_pos];
+                samp_val = s0 + (s1 - s0) * frac;
+            }
+            v.pos += effective_pitch;
+
+            if (v.data.looping && v.data.loop_end > v.data.loop_start) {
+                double loop_len = v.data.loop_end - v.data.loop_start;
+                while (v.pos >= v.data.loop_end) v.pos -= loop_len;
+            } else if (v.pos >= v.data.length) {
+                v.active = false; return;
+            }
+        } else {
+            int pos_i = (int)(v.phase >> 32);
+            u32 frac = (u32)v.phase;
+            u64 step;
+            if (interpolation == Interpolation::Gaussian) {
+                if (!culled) samp_val = (float)Interp::gaussian(gauss, frac >> 24, Interp::tap(v.data, pos_i - 1, v.looped), Interp::tap(v.data, pos_i, v.looped),
+                                                                Interp::tap(v.data, pos_i + 1, v.looped), Interp::tap(v.data, pos_i + 2, v.looped));
+                // 4.12 pitch register, capped at 4x like the hardware
+                step = (u64)std::min<u32>((u32)(effective_pitch * 4096.0), 0x3FFF) << 20;
+            } else if (interpolation == Interpolation::Sinc) {
+                if (!culled) {
+                    float taps[Interp::kSincTaps];
+                    for (int k = 0; k < Interp::kSincTaps; k++) taps[k] = (float)Interp::tap(v.data, pos_i - (Interp::kSincTaps / 2 - 1) + k, v.looped);
+                    // Top 8 fraction bits pick one of the 256 phases
+                    samp_val = Interp::sinc(Interp::sinc_table(effective_pitch) + (frac >> 24) * Interp::kSincTaps, taps);
+                }
+                step = (u64)(effective_pitch * 4294967296.0);
+            } else {
+                if (!culled) {
+                    int s0 = Interp::tap(v.data, pos_i, v.looped), s1 = Interp::tap(v.data, pos_i + 1, v.looped);
+                    samp_val = (float)(s0 + (((s1 - s0) * (s32)(frac >> 17)) >> 15));
+                }
+                step = (u64)(effective_pitch * 4294967296.0);
+            }
+            v.phase += step;
+
+            if (v.data.looping && v.data.loop_end > v.data.loop_start) {
+                u64 loop_end = (u64)v.data.loop_end << 32;
+                if (v.phase >= loop_end) {
+                    v.phase = ((u64)v.data.loop_start << 32) + (v.phase - loop_end) % ((u64)(v.data.loop_end - v.data.loop_start) << 32);
+                    v.looped = true;
+                }
+            } else if ((v.phase >> 32) >= (u64)v.data.length) {
+                v.active = false; return;
+            }
+        }
+
+        if (culled) { culled_count++; continue; }
+        rendered++;
+        float amp = samp_val * adsr_vol * kAmpScale;
+        dl[i] += amp * v.gain_l; dr[i] += amp * v.gain_r;
+        if (v.reverb_on) {
+            float send = amp * v.send;
+            wl[i] += send; wr[i] += send;
+        }
+    }
+}
+
+void SynthEngine::fast_forward(int num_samples) {
+    if (num_samples <= 0) return;
+
+    active_voices.erase(std::remove_if(active_voices.begin(), active_voices.end(), [](const SynthVoice& v) { return !v.active; }), active_voices.end());
+
+    for (int c = 0; c < 16; c++) {
+        ChannelState& ch = channels[c];
+        if (!ch.lfo_enabled || ch.lfo_depth <= 0.0001f) continue;
+        double step = (ch.lfo_rate * 6.283185307f) / (float)sample_rate;
+        ch.lfo_phase = (float)std::fmod(ch.lfo_phase + step * num_samples, 6.283185307);
+    }
+
+    u32 ticks = (u32)num_samples;
+    if (sample_rate != kSpuRate) {
+        u64 clock_end = env_clock + (u64)num_samples * kSpuRate;
+        ticks = (u32)(clock_end / sample_rate);
+        env_clock = clock_end % sample_rate;
+    }
+
+    for (auto& v : active_voices) {
+        v.adsr->Advance(ticks);
+        if (v.adsr->phase == HardwareADSR::Phase::Off) { v.active = false; continue; }
+
+        if (v.sliding) {
+            v.base_pitch_mult *= std::pow(v.portamento_step, (double)num_samples);
+            if ((v.portamento_step > 1.0 && v.base_pitch_mult >= v.target_pitch_mult) ||
+                (v.portamento_step < 1.0 && v.base_pitch_mult <= v.target_pitch_mult)) {
+                v.base_pitch_mult = v.target_pitch_mult;
+                v.sliding = false;
+            }
+        }
+
+        if (v.vibrato_enabled) v.vibrato.tick(v.vibrato_step * num_samples, v.vibrato_depth_step * num_samples);
+
+        double effective_pitch = v.note_base_freq * v.base_pitch_mult * channels[v.ch].pitch_bend_factor;
+        if (effective_pitch < 0.0) effective_pitch = 0.0;
+        bool fixed = interpolation != Interpolation::Linear && !v.noise_mode;
+        if (fixed) v.pos = v.phase / 4294967296.0;
+        v.pos += effective_pitch * num_samples;
+
+        if (v.noise_mode) {
+            v.pos = std::fmod(v.pos, 1.0);
+        } else if (v.data.looping && v.data.loop_end > v.data.loop_start) {
+            double loop_len = v.data.loop_end - v.data.loop_start;
+            if (v.pos >= v.data.loop_end) {
+                v.pos = v.data.loop_start + std::fmod(v.pos - v.data.loop_start, loop_len);
+                v.looped = true;
+            }
+        }
+        if (fixed) v.phase = (u64)(v.pos * 4294967296.0);
+        // One-shots that ran past their end are kept until the envelope finishes: the
+        // position here is only an estimate, and render_block drops them on its first sample.
+    }
+}
+
+void SynthEngine::reset() {
+    SynthEngine fresh;
+    fresh.set_data(bd, hd);
+    fresh.set_samples(samples);
+    fresh.set_envelopes(envelopes);
+    fresh.set_interpolation(interpolation);
+    fresh.set_pan_law(pan_law);
+    fresh.set_sample_rate(sample_rate);
+    fresh.set_cull_threshold(cull_threshold);
+    fresh.mix_pool = std::move(mix_pool);
+    *this = std::move(fresh);
+}
+
+bool SynthEngine::idle() const {
+    for (const auto& v : active_voices) if (v.active) return false;
+    return true;
+}
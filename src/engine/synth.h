@@ -0,0 +1,161 @@
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include "../common.h"
+#include "../format/hd.h"
+#include "../format/bd.h"
+#include "adsr.h"
+#include "vibrato.h"
+#include "samplebank.h"
+#include "envcache.h"
+#include "interp.h"
+#include "gain.h"
+#include "fastmath.h"
+#include "mixpool.h"
+#include <vector>
+#include <map>
+#include <memory>
+
+class FastNoise {
+    uint32_t state = 0xA491;
+public:
+    inline int16_t next() {
+        uint32_t x = state;
+        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        state = x;
+        return (int16_t)(x & 0xFFFF);
+    }
+};
+
+struct SynthVoice {
+    SampleView data;
+    double pos = 0.0;
+    u64 phase = 0;           // 32.32 position used by the fixed-point interpolation modes
+    bool looped = false;     // Has wrapped from loop_end back to loop_start at least once
+    double base_pitch_mult = 1.0;
+    double target_pitch_mult = 1.0;
+    double portamento_step = 1.0;
+    double note_base_freq = 1.0;
+    bool sliding = false;
+    float base_vol_factor = 0.0f;
+    int tone_pan = 64;
+    float gain_l = 0.0f, gain_r = 0.0f, send = 0.0f;   // Output gains, refreshed when the channel mix changes
+    u32 mix_version = 0;
+    int ch = 0; int note_key = 0; bool active = false; bool reverb_on = false;
+    std::shared_ptr<HardwareADSR> adsr; bool release_pending = false;
+
+    VibratoEngine vibrato;
+    bool vibrato_enabled = false;
+    u64 vibrato_step = 0;        // Per-sample 32.32 steps through the pitch wave and depth curve
+    u64 vibrato_depth_step = 0;
+
+    bool noise_mode = false;
+};
+
+class SynthEngine {
+public:
+    // The SPU's native rate; samples and envelopes run at it
+    static constexpr int kSpuRate = 44100;
+
+    struct ChannelState {
+        int prog = 0; double pitch_bend_factor = 1.0; double pitch_mult = 12.0;
+        int vol = 127, expr = 127, pan = 64, reverb_depth = 0;
+        u32 mix_version = 0;    // Bumped whenever vol, expr, pan or reverb_depth change
+        int attack_mod = 64, release_mod = 64;
+        bool sustain_active = false; bool portamento_active = false; int portamento_time = 0;
+        int rpn_msb = 127, rpn_lsb = 127, nrpn_msb = 127, nrpn_lsb = 127;
+        int modulation = 0; int breath_rate = 0;
+        bool lfo_enabled = false; float lfo_rate = 5.0f; float lfo_depth = 0.0f;
+        float lfo_phase = 0.0f; float lfo_sensitivity = 0.0f; double last_note_pitch = -1.0;
+        void reset_controllers() {
+            vol = 127; expr = 127; pan = 64; mix_version++;
+            pitch_bend_factor = 1.0;
+            sustain_active = false; portamento_active = false;
+            lfo_enabled = false; lfo_depth = 0.0f; modulation = 0;
+        }
+        double get_lfo_ratio(float sample_rate) {
+            if (!lfo_enabled || lfo_depth <= 0.0001f) return 1.0;
+            lfo_phase += (lfo_rate * 6.283185307f) / sample_rate;
+            if (lfo_phase > 6.283185307f) lfo_phase -= 6.283185307f;
+            float val = FastMath::sine(lfo_phase * (1.0 / 6.283185307)) * lfo_depth * lfo_sensitivity;
+            return FastMath::semitone_ratio(val);
+        }
+    };
+
+    ChannelState channels[16];
+    std::vector<SynthVoice> active_voices;
+    std::map<u32, DecodedSample> sample_cache;
+
+    BDParser* bd = nullptr;
+    HDParser* hd = nullptr;
+    const SampleBank* samples = nullptr;
+    EnvelopeCache* envelopes = nullptr;
+    Interpolation interpolation = Interpolation::Linear;
+    PanLaw pan_law = PanLaw::ConstantPower;
+    int sample_rate = kSpuRate;
+    u64 env_clock = 0;       // Envelope ticks owed, in 1/sample_rate units, when not running at kSpuRate
+    u64 voice_samples = 0;   // Voice-samples rendered so far, for cost reporting
+    float cull_threshold = 0.0f;  // Linear peak level below which a voice is not mixed, 0 mixes everything
+    u64 culled_samples = 0;  // Voice-samples skipped as inaudible
+    u64 voices_retired = 0;  // Releasing voices stopped early because they can't be heard again
+
+    // Per-block envelope levels, num_samples per voice, and how many of them each voice gets
+    std::vector<s16> env_buf;
+    std::vector<int> env_len;
+    std::vector<s16> env_ticks;
+    std::vector<u8> env_cull;   // Voices skipped for the current block
+
+    // Per-block channel LFO ratios, rows for the channels with lfo_on, and the shared noise
+    std::vector<double> lfo_buf;
+    bool lfo_on[16] = {};
+    std::vector<s16> noise_buf;
+    FastNoise noise;
+
+    // Worker threads and their sub-mixes when a block's voices are split up. Groups have a
+    // fixed size, so the summation order never depends on the thread count.
+    static constexpr int kVoicesPerGroup = 8;
+    struct SubMix {
+        std::vector<float> dl, dr, wl, wr;
+        u64 rendered = 0, culled = 0;
+    };
+    std::unique_ptr<MixPool> mix_pool;
+    std::vector<SubMix> sub_mixes;
+
+    void set_data(BDParser* _bd, HDParser* _hd) { bd = _bd; hd = _hd; }
+    // Preloaded samples to use before falling back to decoding on first use
+    void set_samples(const SampleBank* bank) { samples = bank; }
+    // Shared key-on curves, voices simulate their own envelope when unset
+    void set_envelopes(EnvelopeCache* cache) { envelopes = cache; }
+    void set_interpolation(Interpolation mode) { interpolation = mode; }
+    void set_pan_law(PanLaw law) { pan_law = law; for (auto& ch : channels) ch.mix_version++; }
+    // Output rate; samples are resampled and time constants scaled to it
+    void set_sample_rate(int rate) { sample_rate = rate > 0 ? rate : kSpuRate; }
+    // Voices whose block peak stays under this linear level are advanced but not mixed
+    void set_cull_threshold(float level) { cull_threshold = level > 0.0f ? level : 0.0f; }
+    // Threads a block's voices are spread over, 1 mixes on the calling thread
+    void set_mix_threads(int threads);
+    // Back to the power-on state, keeping the data and render settings above
+    void reset();
+
+    void note_on(int ch_idx, int note, int vel);
+    void note_off(int ch_idx, int note);
+    void program_change(int ch_idx, int prog_id) { channels[ch_idx].prog = prog_id; }
+    void pitch_bend(int ch_idx, int val);
+    void control_change(int ch_idx, int cc, int val);
+
+    void render_block(int num_samples, std::vector<float>& dl, std::vector<float>& dr, std::vector<float>& wl, std::vector<float>& wr);
+
+    // Advances voice and channel state by num_samples without producing audio.
+    // Envelopes are stepped exactly; sample positions ignore vibrato and LFO.
+    void fast_forward(int num_samples);
+    // True when no voice is sounding, so the engine's output depends only on channel state.
+    bool idle() const;
+
+private:
+    // Recomputes a voice's output gains from its channel's volume, expression, pan and reverb depth
+    void update_gains(SynthVoice& v);
+    // Renders one voice's share of the block into the given buffers
+    void render_voice(size_t vi, int num_samples, float* dl, float* dr, float* wl, float* wr, u64& rendered, u64& culled_count);
+};
+
+#endif // SYNTH_H
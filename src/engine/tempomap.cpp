@@ -0,0 +1,97 @@
+#include "tempomap.h"
+#include <algorithm>
+#include <numeric>
+
+// a * b as a 128-bit hi:lo pair
+static void Mul128(u64 a, u64 b, u64& hi, u64& lo) {
+    u64 a0 = (u32)a, a1 = a >> 32, b0 = (u32)b, b1 = b >> 32;
+    u64 p00 = a0 * b0, p01 = a0 * b1, p10 = a1 * b0, p11 = a1 * b1;
+    u64 mid = (p00 >> 32) + (u32)p01 + (u32)p10;
+    lo = (mid << 32) | (u32)p00;
+    hi = p11 + (p01 >> 32) + (p10 >> 32) + (mid >> 32);
+}
+
+// hi:lo / d, quotient truncated to 64 bits. Bitwise, but it only runs once per event.
+static u64 Div128(u64 hi, u64 lo, u64 d, u64& rem) {
+    u64 q = 0, r = 0;
+    for (int i = 127; i >= 0; i--) {
+        u64 bit = i >= 64 ? (hi >> (i - 64)) & 1 : (lo >> i) & 1;
+        bool carry = (r >> 63) != 0;
+        r = (r << 1) | bit;
+        q <<= 1;
+        if (carry || r >= d) { r -= d; q |= 1; }
+    }
+    rem = r;
+    return q;
+}
+
+void TempoMap::reset(int ticks_per_quarter, int sample_rate, u64 quarter_us_num, u64 quarter_us_den) {
+    m_ticks_per_quarter = ticks_per_quarter > 0 ? (u64)ticks_per_quarter : 480;
+    m_sample_rate = sample_rate > 0 ? (u64)sample_rate : 44100;
+    m_segments.clear();
+    Segment first;
+    first.tempo = make_tempo(quarter_us_num, quarter_us_den);
+    m_segments.push_back(first);
+}
+
+TempoMap::Tempo TempoMap::make_tempo(u64 quarter_us_num, u64 quarter_us_den) const {
+    // A zero tempo would never advance, fall back to 120 bpm
+    if (quarter_us_num == 0 || quarter_us_den == 0) { quarter_us_num = 500000; quarter_us_den = 1; }
+    Tempo tempo;
+    tempo.num = quarter_us_num * m_sample_rate;
+    tempo.den = quarter_us_den * 1000000 * m_ticks_per_quarter;
+    u64 g = std::gcd(tempo.num, tempo.den);
+    tempo.num /= g;
+    tempo.den /= g;
+    return tempo;
+}
+
+void TempoMap::set_tempo(u64 tick, u64 quarter_us_num, u64 quarter_us_den) {
+    set_tempo(tick, make_tempo(quarter_us_num, quarter_us_den));
+}
+
+void TempoMap::set_tempo(u64 tick, const Tempo& tempo) {
+    const Segment& last = segment_at(tick);
+    if (tempo.num == last.tempo.num && tempo.den == last.tempo.den) return;
+
+    // The new segment starts where the old one has got to, down to a 2^-32 sample
+    Segment seg;
+    seg.tick = tick;
+    seg.tempo = tempo;
+    u64 hi, lo, rem;
+    Mul128(tick - last.tick, last.tempo.num, hi, lo);
+    u64 whole = Div128(hi, lo, last.tempo.den, rem);
+    u64 frac = Div128(rem >> 32, rem << 32, last.tempo.den, rem);
+    frac += last.start_frac;
+    seg.start = last.start + whole + (frac >> 32);
+    seg.start_frac = (u32)frac;
+
+    while (!m_segments.empty() && m_segments.back().tick >= tick) m_segments.pop_back();
+    m_segments.push_back(seg);
+}
+
+TempoMap::Tempo TempoMap::tempo_at(u64 tick) const {
+    return segment_at(tick).tempo;
+}
+
+const TempoMap::Segment& TempoMap::segment_at(u64 tick) const {
+    // Last segment starting at or before tick
+    auto it = std::upper_bound(m_segments.begin(), m_segments.end(), tick,
+                               [](u64 t, const Segment& s) { return t < s.tick; });
+    return it == m_segments.begin() ? *it : *(it - 1);
+}
+
+u64 TempoMap::sample_at(u64 tick) const {
+    const Segment& seg = segment_at(tick);
+    u64 hi, lo, rem;
+    Mul128(tick - seg.tick, seg.tempo.num, hi, lo);
+    u64 whole = Div128(hi, lo, seg.tempo.den, rem);
+    // Carries the start's fraction into the floor
+    u64 frac = Div128(rem >> 32, rem << 32, seg.tempo.den, rem) + seg.start_frac;
+    return seg.start + whole + (frac >> 32);
+}
+
+float TempoMap::samples_per_tick(u64 tick) const {
+    const Segment& seg = segment_at(tick);
+    return (float)((double)seg.tempo.num / (double)seg.tempo.den);
+}
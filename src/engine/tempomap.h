@@ -0,0 +1,48 @@
+#ifndef TEMPOMAP_H
+#define TEMPOMAP_H
+
+#include "../common.h"
+#include <vector>
+
+// Converts sequence ticks to output samples with integer math. Every tempo starts a
+// segment; a tick's sample is computed from its offset into the segment, so event
+// positions never pick up rounding from the events before them. Segment starts keep a
+// 32-bit fraction of a sample, which is the only rounding, once per tempo change.
+class TempoMap {
+public:
+    // Samples per tick, reduced
+    struct Tempo {
+        u64 num = 1, den = 1;
+    };
+
+    // Quarter note length is given in microseconds as num / den, so both MIDI's
+    // microseconds per quarter (mpqn / 1) and an SQ header's bpm (60000000 / bpm) are exact.
+    void reset(int ticks_per_quarter, int sample_rate, u64 quarter_us_num, u64 quarter_us_den);
+    // Tempo from tick on. Ticks must not go backwards; a same-tempo change is ignored.
+    void set_tempo(u64 tick, u64 quarter_us_num, u64 quarter_us_den);
+    // Puts back a tempo read with tempo_at, e.g. when a loop jumps back to its start
+    void set_tempo(u64 tick, const Tempo& tempo);
+    Tempo tempo_at(u64 tick) const;
+
+    // Output sample a tick lands on, the floor of its exact time. Binary searches the segments.
+    u64 sample_at(u64 tick) const;
+    float samples_per_tick(u64 tick) const;
+    size_t segment_count() const { return m_segments.size(); }
+
+private:
+    struct Segment {
+        u64 tick = 0;
+        u64 start = 0;      // Whole samples
+        u32 start_frac = 0; // and 2^-32ths
+        Tempo tempo;
+    };
+
+    const Segment& segment_at(u64 tick) const;
+    Tempo make_tempo(u64 quarter_us_num, u64 quarter_us_den) const;
+
+    std::vector<Segment> m_segments;
+    u64 m_ticks_per_quarter = 480;
+    u64 m_sample_rate = 44100;
+};
+
+#endif // TEMPOMAP_H
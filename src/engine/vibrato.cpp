@@ -1,97 +1,71 @@
 #include "vibrato.h"
-#include <array>
 #include <cmath>
 #include <algorithm>
 
-static const std::array<u8, 256> kVibratoSineTable = []() {
-    std::array<u8, 256> table{};
-    for (size_t i = 0; i < table.size(); ++i) {
-        double s = std::sin((double)i * 2.0 * M_PI / 256.0);
-        int v = (int)std::round(127.5 + 127.5 * s);
-        table[i] = (u8)std::clamp(v, 0, 255);
-    }
+const std::vector<u8>& VibratoEngine::sine_wave() {
+    static const std::vector<u8> table = []() {
+        std::vector<u8> t(256);
+        for (size_t i = 0; i < t.size(); ++i) {
+            // Built once, so the exact sine costs nothing per sample
+            double s = std::sin(i * 6.283185307179586 / 256.0);
+            int v = (int)std::round(127.5 + 127.5 * s);
+            t[i] = (u8)std::clamp(v, 0, 255);
+        }
+        return t;
+    }();
     return table;
-}();
+}
 
-void VibratoEngine::init(const std::vector<u8>& wave_data,
-                         const std::vector<u8>& depth_data,
+void VibratoEngine::init(const std::vector<u8>* wave,
+                         const std::vector<u8>* depth_curve,
                          u8 start_phase,
                          u8 start_depth_phase) {
-    // PS1 driver uses a sine table, allows override but default to sine
-    lfo_table.clear();
-    if (!wave_data.empty()) lfo_table = wave_data;
-    else lfo_table.assign(kVibratoSineTable.begin(), kVibratoSineTable.end());
+    if (!wave || wave->empty()) wave = &sine_wave();
+    lfo_table = wave->data();
+    lfo_size = (u32)wave->size();
+    phase = (u64)(start_phase % lfo_size) << 32;
 
-    // Breath apply and smooth and wrap to avoid edge clicks
-    depth_table.clear();
-    if (!depth_data.empty()) {
-        depth_table = depth_data;
-        if (depth_table.size() > 3) {
-            std::vector<u8> smoothed(depth_table.size());
-            size_t n = depth_table.size();
-            for (size_t i = 0; i < n; ++i) {
-                int prev = depth_table[(i + n - 1) % n];
-                int cur  = depth_table[i];
-                int next = depth_table[(i + 1) % n];
-                int avg = (prev + cur + next) / 3;
-                smoothed[i] = (u8)std::clamp(avg, 0, 255);
-            }
-            depth_table.swap(smoothed);
-        }
-        if (depth_table.size() >= 2) depth_table.back() = depth_table.front();
+    if (depth_curve && !depth_curve->empty()) {
+        depth_table = depth_curve->data();
+        depth_size = (u32)depth_curve->size();
+        depth_phase = (u64)(start_depth_phase % depth_size) << 32;
+    } else {
+        depth_table = nullptr;
+        depth_size = 0;
+        depth_phase = 0;
     }
-
-    active = !lfo_table.empty();
-    if (active) {
-        double max_sz = (double)lfo_table.size();
-        phase = std::fmod((double)start_phase, max_sz);
-        if (phase < 0.0) phase += max_sz;
-    } else phase = 0.0;
-
-    if (!depth_table.empty()) {
-        double max_sz = (double)depth_table.size();
-        depth_phase = std::fmod((double)start_depth_phase, max_sz);
-        if (depth_phase < 0.0) depth_phase += max_sz;
-    } else depth_phase = 0.0;
+    active = true;
 }
 
-void VibratoEngine::tick(double rate_step, double depth_rate_step) {
-    if (!active || lfo_table.empty()) return;
+void VibratoEngine::tick(u64 rate_step, u64 depth_rate_step) {
+    if (!active) return;
+    u64 wrap = (u64)lfo_size << 32;
     phase += rate_step;
-    double max_sz = (double)lfo_table.size();
-    if (phase >= max_sz) phase = std::fmod(phase, max_sz);
-    if (phase < 0.0) { phase = std::fmod(phase, max_sz); if (phase < 0.0) phase += max_sz; }
+    if (phase >= wrap) phase %= wrap;
 
-    if (!depth_table.empty()) {
+    if (depth_table) {
+        u64 depth_wrap = (u64)depth_size << 32;
         depth_phase += depth_rate_step;
-        double depth_sz = (double)depth_table.size();
-        if (depth_phase >= depth_sz) depth_phase = std::fmod(depth_phase, depth_sz);
-        if (depth_phase < 0.0) { depth_phase = std::fmod(depth_phase, depth_sz); if (depth_phase < 0.0) depth_phase += depth_sz; }
+        if (depth_phase >= depth_wrap) depth_phase %= depth_wrap;
     }
 }
 
-float VibratoEngine::get_pitch_offset() const {
-    if (!active || lfo_table.empty()) return 0.0f;
+// Linear interpolation between entries, rounded to the nearest step
+static inline int SampleTable(const u8* table, u32 size, u64 pos) {
+    u32 idx0 = (u32)(pos >> 32);
+    u32 idx1 = idx0 + 1 == size ? 0 : idx0 + 1;
+    s64 val = ((s64)table[idx0] << 32) + (s64)(table[idx1] - table[idx0]) * (u32)pos;
+    return (int)((val + 0x80000000ll) >> 32);
+}
 
-    auto sample_table = [](const std::vector<u8>& tbl, double ph) -> double {
-        size_t sz = tbl.size();
-        int idx0 = (int)ph;
-        double frac = ph - idx0;
-        idx0 = idx0 % sz; if (idx0 < 0) idx0 += sz;
-        int idx1 = (idx0 + 1) % sz;
-        double val0 = (double)tbl[idx0]; double val1 = (double)tbl[idx1];
-        double interp = val0 + (val1 - val0) * frac;
-        uint32_t v = (uint32_t)std::round(interp); return (double)std::min(v, 255U);
-    };
+float VibratoEngine::get_pitch_offset() const {
+    if (!active) return 0.0f;
 
-    double lfo_val = sample_table(lfo_table, phase);
+    double lfo_val = SampleTable(lfo_table, lfo_size, phase);
     double center_offset = (lfo_val / 255.0) - 0.5; // [-0.5, +0.5]
 
     double depth_scale = 1.0;
-    if (!depth_table.empty()) {
-        double dval = sample_table(depth_table, depth_phase);
-        depth_scale = dval / 255.0; // [0,1]
-    }
+    if (depth_table) depth_scale = SampleTable(depth_table, depth_size, depth_phase) / 255.0; // [0,1]
 
     return (float)(center_offset * 2.0 * depth * depth_scale);
 }
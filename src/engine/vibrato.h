@@ -6,17 +6,24 @@
 
 class VibratoEngine {
 public:
-    std::vector<u8> lfo_table;
-    std::vector<u8> depth_table;
-    double phase = 0.0;
-    double depth_phase = 0.0;
+    // The PS1 driver's default pitch wave, 256 steps of sine
+    static const std::vector<u8>& sine_wave();
+
+    // Borrowed tables, they must outlive the voice
+    const u8* lfo_table = nullptr; u32 lfo_size = 0;
+    const u8* depth_table = nullptr; u32 depth_size = 0;
+    u64 phase = 0;          // 32.32 positions in the tables
+    u64 depth_phase = 0;
     bool active = false; float depth = 0.0f;
 
-    void init(const std::vector<u8>& wave_data,
-              const std::vector<u8>& depth_data,
+    // A null or empty wave uses the sine, a null or empty depth curve keeps full depth.
+    // Depth curves come ready-made from HDParser::breath_depths.
+    void init(const std::vector<u8>* wave,
+              const std::vector<u8>* depth_curve,
               u8 start_phase = 0,
               u8 start_depth_phase = 0);
-    void tick(double rate_step, double depth_rate_step);
+    // Steps are in 32.32 table positions and may span several cycles
+    void tick(u64 rate_step, u64 depth_rate_step);
     float get_pitch_offset() const;
 };
 
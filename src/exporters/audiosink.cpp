@@ -0,0 +1,80 @@
+#include "audiosink.h"
+#include <cstring>
+
+struct WavHeader {
+    char riff[4] = {'R','I','F','F'};
+    u32 overall_size;
+    char wave[4] = {'W','A','V','E'};
+    char fmt[4] = {'f','m','t',' '};
+    u32 fmt_length = 16;
+    u16 format_type = 1;
+    u16 channels = 2;
+    u32 sample_rate = 44100;
+    u32 byte_rate = 44100 * 4;
+    u16 block_align = 4;
+    u16 bits_per_sample = 16;
+    char data[4] = {'d','a','t','a'};
+    u32 data_size;
+};
+
+static int BytesPerSample(SampleFormat format) {
+    switch (format) {
+        case SampleFormat::Pcm24: return 3;
+        case SampleFormat::Float32: return 4;
+        default: return 2;
+    }
+}
+
+void WavSink::write_header() {
+    int bytes = BytesPerSample(m_format);
+    WavHeader h;
+    h.format_type = (m_format == SampleFormat::Float32) ? 3 : 1;
+    h.sample_rate = (u32)m_sample_rate;
+    h.block_align = (u16)(bytes * 2);
+    h.byte_rate = h.sample_rate * h.block_align;
+    h.bits_per_sample = (u16)(bytes * 8);
+    h.data_size = (u32)(m_frames * h.block_align);
+    h.overall_size = h.data_size + 36;
+    m_file.write((const char*)&h, sizeof(h));
+}
+
+bool WavSink::open(const std::string& path, int sample_rate) {
+    m_file.open(path, std::ios::binary);
+    if (!m_file.is_open()) return false;
+    m_sample_rate = sample_rate;
+    m_frames = 0;
+    write_header();
+    return m_file.good();
+}
+
+bool WavSink::write(const float* left, const float* right, size_t count) {
+    int bytes = BytesPerSample(m_format);
+    m_buffer.resize(count * bytes * 2);
+    u8* out = m_buffer.data();
+    for (size_t i = 0; i < count; i++) {
+        for (float v : { left[i], right[i] }) {
+            if (m_format == SampleFormat::Float32) {
+                std::memcpy(out, &v, 4);
+            } else if (m_format == SampleFormat::Pcm24) {
+                s32 s = to_pcm24(v);
+                out[0] = (u8)s; out[1] = (u8)(s >> 8); out[2] = (u8)(s >> 16);
+            } else {
+                s16 s = to_pcm16(v);
+                std::memcpy(out, &s, 2);
+            }
+            out += bytes;
+        }
+    }
+    m_file.write((const char*)m_buffer.data(), m_buffer.size());
+    m_frames += count;
+    return m_file.good();
+}
+
+bool WavSink::close() {
+    if (!m_file.is_open()) return false;
+    m_file.seekp(0);
+    write_header();
+    bool ok = m_file.good();
+    m_file.close();
+    return ok;
+}
@@ -0,0 +1,45 @@
+#ifndef AUDIOSINK_H
+#define AUDIOSINK_H
+
+#include "../common.h"
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+enum class SampleFormat { Pcm16, Pcm24, Float32 };
+
+// Receives the final stereo mix as it is rendered and writes it out
+class AudioSink {
+public:
+    virtual ~AudioSink() = default;
+    virtual bool open(const std::string& path, int sample_rate) = 0;
+    virtual bool write(const float* left, const float* right, size_t count) = 0;
+    // Finishes the file, nothing is guaranteed complete on disk before this
+    virtual bool close() = 0;
+
+protected:
+    static s16 to_pcm16(float v) { return (s16)(std::clamp(v, -1.0f, 1.0f) * 32767.0f); }
+    static s32 to_pcm24(float v) { return (s32)(std::clamp(v, -1.0f, 1.0f) * 8388607.0f); }
+};
+
+// Streams a WAV file, filling in the header sizes on close
+class WavSink : public AudioSink {
+public:
+    explicit WavSink(SampleFormat format = SampleFormat::Pcm16) : m_format(format) {}
+
+    bool open(const std::string& path, int sample_rate) override;
+    bool write(const float* left, const float* right, size_t count) override;
+    bool close() override;
+
+private:
+    void write_header();
+
+    SampleFormat m_format;
+    std::ofstream m_file;
+    int m_sample_rate = 44100;
+    u64 m_frames = 0;
+    std::vector<u8> m_buffer;
+};
+
+#endif // AUDIOSINK_H
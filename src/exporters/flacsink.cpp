@@ -0,0 +1,435 @@
+#include "flacsink.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+// MSB-first bit packer
+class BitWriter {
+public:
+    std::vector<u8> bytes;
+
+    void put(u32 value, int bits) {
+        if (bits == 0) return;
+        u64 mask = (bits == 32) ? 0xFFFFFFFFull : ((1ull << bits) - 1);
+        m_acc = (m_acc << bits) | (value & mask);
+        m_count += bits;
+        while (m_count >= 8) {
+            m_count -= 8;
+            bytes.push_back((u8)(m_acc >> m_count));
+        }
+    }
+    void put_signed(s32 value, int bits) { put((u32)value, bits); }
+    void put_rice(u32 value, int k) {
+        u32 q = value >> k;
+        while (q >= 32) { put(0, 32); q -= 32; }
+        if (q + 1 + k <= 32) {
+            put((1u << k) | (value & ((1u << k) - 1)), q + 1 + k);
+        } else {
+            put(1, q + 1);
+            put(value, k);
+        }
+    }
+    // UTF-8 style variable length number used for frame numbers
+    void put_utf8(u32 value) {
+        if (value < 0x80) { put(value, 8); return; }
+        int extra = value < 0x800 ? 1 : value < 0x10000 ? 2 : value < 0x200000 ? 3 : value < 0x4000000 ? 4 : 5;
+        put(((0xFF00u >> (extra + 1)) & 0xFF) | (value >> (6 * extra)), 8);
+        for (int i = extra - 1; i >= 0; i--) put(0x80 | ((value >> (6 * i)) & 0x3F), 8);
+    }
+    void align() { if (m_count) put(0, 8 - m_count); }
+
+private:
+    u64 m_acc = 0;
+    int m_count = 0;
+};
+
+static u8 Crc8(const u8* data, size_t len) {
+    u8 crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) crc = (crc & 0x80) ? (u8)((crc << 1) ^ 0x07) : (u8)(crc << 1);
+    }
+    return crc;
+}
+
+static u16 Crc16(const u8* data, size_t len) {
+    u16 crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (u16)data[i] << 8;
+        for (int b = 0; b < 8; b++) crc = (crc & 0x8000) ? (u16)((crc << 1) ^ 0x8005) : (u16)(crc << 1);
+    }
+    return crc;
+}
+
+static inline u32 ZigZag(s32 v) { return ((u32)v << 1) ^ (u32)(v >> 31); }
+
+// Rice partitioning of one residual, chosen from bit estimates
+struct RicePlan {
+    int order = 0;
+    std::vector<int> params;
+    u64 bits = UINT64_MAX;
+};
+
+static const int kMaxRiceParam = 14;
+static const int kMaxPartitionOrder = 8;
+
+static int BestRiceParam(u64 sum, u32 count, u64& bits) {
+    int best = 0;
+    bits = UINT64_MAX;
+    for (int k = 0; k <= kMaxRiceParam; k++) {
+        u64 b = (u64)count * (k + 1) + (sum >> k);
+        if (b < bits) { bits = b; best = k; }
+    }
+    return best;
+}
+
+static RicePlan PlanResidual(const std::vector<u32>& folded, int n, int predictor_order) {
+    RicePlan best;
+    int max_order = 0;
+    while (max_order < kMaxPartitionOrder && (n % (2 << max_order)) == 0 && (n >> (max_order + 1)) > predictor_order) max_order++;
+
+    // Sums for the finest partitioning, merged pairwise for the coarser ones
+    std::vector<u64> sums(1u << max_order, 0);
+    int part = n >> max_order;
+    for (int p = 0, i = predictor_order; p < (1 << max_order); p++) {
+        int end = (p + 1) * part;
+        for (; i < end; i++) sums[p] += folded[i];
+    }
+    for (int order = max_order; order >= 0; order--) {
+        RicePlan plan;
+        plan.order = order;
+        plan.bits = 2 + 4;
+        int count = n >> order;
+        for (int p = 0; p < (1 << order); p++) {
+            u32 samples = (p == 0) ? (u32)(count - predictor_order) : (u32)count;
+            u64 bits;
+            plan.params.push_back(BestRiceParam(sums[p], samples, bits));
+            plan.bits += 4 + bits;
+        }
+        if (plan.bits < best.bits) best = plan;
+        for (int p = 0; p < (1 << order) / 2; p++) sums[p] = sums[2 * p] + sums[2 * p + 1];
+    }
+    return best;
+}
+
+// One candidate encoding of a channel
+struct SubframePlan {
+    enum Type { Constant, Verbatim, Fixed, Lpc } type = Verbatim;
+    int order = 0;
+    std::vector<s32> residual;
+    std::vector<s32> coefs;
+    int precision = 0, shift = 0;
+    RicePlan rice;
+    u64 bits = UINT64_MAX;
+};
+
+static const s32 kResidualLimit = 1 << 30;
+
+static bool FoldResidual(const std::vector<s32>& residual, int order, std::vector<u32>& folded) {
+    folded.assign(residual.size(), 0);
+    for (size_t i = order; i < residual.size(); i++) {
+        if (residual[i] >= kResidualLimit || residual[i] <= -kResidualLimit) return false;
+        folded[i] = ZigZag(residual[i]);
+    }
+    return true;
+}
+
+static void TryFixed(const s32* x, int n, int bps, SubframePlan& best, std::vector<u32>& folded) {
+    for (int order = 0; order <= 4 && order < n; order++) {
+        SubframePlan plan;
+        plan.type = SubframePlan::Fixed;
+        plan.order = order;
+        plan.residual.assign(n, 0);
+        for (int i = order; i < n; i++) {
+            s64 e;
+            switch (order) {
+                case 0: e = x[i]; break;
+                case 1: e = (s64)x[i] - x[i-1]; break;
+                case 2: e = (s64)x[i] - 2 * (s64)x[i-1] + x[i-2]; break;
+                case 3: e = (s64)x[i] - 3 * (s64)x[i-1] + 3 * (s64)x[i-2] - x[i-3]; break;
+                default: e = (s64)x[i] - 4 * (s64)x[i-1] + 6 * (s64)x[i-2] - 4 * (s64)x[i-3] + x[i-4]; break;
+            }
+            plan.residual[i] = (s32)std::clamp<s64>(e, -kResidualLimit, kResidualLimit);
+        }
+        if (!FoldResidual(plan.residual, order, folded)) continue;
+        plan.rice = PlanResidual(folded, n, order);
+        plan.bits = 8 + (u64)order * bps + plan.rice.bits;
+        if (plan.bits < best.bits) best = std::move(plan);
+    }
+}
+
+static const int kMaxLpcOrder = 8;
+static const int kLpcPrecision = 12;
+
+static void TryLpc(const s32* x, int n, int bps, SubframePlan& best, std::vector<u32>& folded) {
+    if (n <= kMaxLpcOrder * 2) return;
+
+    // Welch-windowed autocorrelation
+    std::vector<double> w(n);
+    for (int i = 0; i < n; i++) {
+        double t = (2.0 * i - (n - 1)) / (n + 1);
+        w[i] = x[i] * (1.0 - t * t);
+    }
+    double r[kMaxLpcOrder + 1];
+    for (int lag = 0; lag <= kMaxLpcOrder; lag++) {
+        double sum = 0.0;
+        for (int i = lag; i < n; i++) sum += w[i] * w[i - lag];
+        r[lag] = sum;
+    }
+    if (r[0] <= 0.0) return;
+
+    // Levinson-Durbin, keeping the coefficients of every order
+    double lpc[kMaxLpcOrder + 1][kMaxLpcOrder] = {};
+    double a[kMaxLpcOrder] = {};
+    double err = r[0];
+    for (int m = 0; m < kMaxLpcOrder; m++) {
+        double acc = r[m + 1];
+        for (int j = 0; j < m; j++) acc -= a[j] * r[m - j];
+        double k = acc / err;
+        double next[kMaxLpcOrder];
+        for (int j = 0; j < m; j++) next[j] = a[j] - k * a[m - 1 - j];
+        next[m] = k;
+        std::copy(next, next + m + 1, a);
+        std::copy(a, a + m + 1, lpc[m + 1]);
+        err *= (1.0 - k * k);
+        if (err <= 0.0) break;
+    }
+
+    for (int order = 1; order <= kMaxLpcOrder; order++) {
+        const double* c = lpc[order];
+        double cmax = 0.0;
+        for (int j = 0; j < order; j++) cmax = std::max(cmax, std::fabs(c[j]));
+        if (cmax <= 0.0) continue;
+
+        int exponent;
+        std::frexp(cmax, &exponent);
+        int shift = std::clamp(kLpcPrecision - 1 - exponent, 0, 15);
+        s32 qmax = (1 << (kLpcPrecision - 1)) - 1, qmin = -(1 << (kLpcPrecision - 1));
+
+        SubframePlan plan;
+        plan.type = SubframePlan::Lpc;
+        plan.order = order;
+        plan.precision = kLpcPrecision;
+        plan.shift = shift;
+        double carry = 0.0;
+        for (int j = 0; j < order; j++) {
+            double v = c[j] * (1 << shift) + carry;
+            s32 q = std::clamp((s32)std::lround(v), qmin, qmax);
+            carry = v - q;
+            plan.coefs.push_back(q);
+        }
+
+        plan.residual.assign(n, 0);
+        bool ok = true;
+        for (int i = order; i < n && ok; i++) {
+            s64 sum = 0;
+            for (int j = 0; j < order; j++) sum += (s64)plan.coefs[j] * x[i - 1 - j];
+            s64 e = x[i] - (sum >> shift);
+            if (e >= kResidualLimit || e <= -kResidualLimit) ok = false;
+            else plan.residual[i] = (s32)e;
+        }
+        if (!ok || !FoldResidual(plan.residual, order, folded)) continue;
+        plan.rice = PlanResidual(folded, n, order);
+        plan.bits = 8 + (u64)order * bps + 4 + 5 + (u64)order * kLpcPrecision + plan.rice.bits;
+        if (plan.bits < best.bits) best = std::move(plan);
+    }
+}
+
+static SubframePlan PlanSubframe(const s32* x, int n, int bps) {
+    SubframePlan best;
+    if (std::all_of(x, x + n, [&](s32 v) { return v == x[0]; })) {
+        best.type = SubframePlan::Constant;
+        best.bits = 8 + bps;
+        return best;
+    }
+    best.type = SubframePlan::Verbatim;
+    best.bits = 8 + (u64)n * bps;
+
+    std::vector<u32> folded;
+    TryFixed(x, n, bps, best, folded);
+    TryLpc(x, n, bps, best, folded);
+    return best;
+}
+
+static void WriteSubframe(BitWriter& bw, const SubframePlan& plan, const s32* x, int n, int bps) {
+    switch (plan.type) {
+        case SubframePlan::Constant:
+            bw.put(0x00, 8);
+            bw.put_signed(x[0], bps);
+            return;
+        case SubframePlan::Verbatim:
+            bw.put(0x02, 8);
+            for (int i = 0; i < n; i++) bw.put_signed(x[i], bps);
+            return;
+        case SubframePlan::Fixed:
+            bw.put((0x08 | plan.order) << 1, 8);
+            break;
+        case SubframePlan::Lpc:
+            bw.put((0x20 | (plan.order - 1)) << 1, 8);
+            break;
+    }
+    for (int i = 0; i < plan.order; i++) bw.put_signed(x[i], bps);
+    if (plan.type == SubframePlan::Lpc) {
+        bw.put(plan.precision - 1, 4);
+        bw.put_signed(plan.shift, 5);
+        for (s32 c : plan.coefs) bw.put_signed(c, plan.precision);
+    }
+
+    bw.put(0, 2);   // Rice coding with 4-bit parameters
+    bw.put(plan.rice.order, 4);
+    int count = n >> plan.rice.order;
+    int i = plan.order;
+    for (int p = 0; p < (1 << plan.rice.order); p++) {
+        int k = plan.rice.params[p];
+        bw.put(k, 4);
+        for (int end = (p + 1) * count; i < end; i++) bw.put_rice(ZigZag(plan.residual[i]), k);
+    }
+}
+
+static int SampleRateCode(int rate) {
+    switch (rate) {
+        case 88200: return 1; case 176400: return 2; case 192000: return 3;
+        case 8000: return 4; case 16000: return 5; case 22050: return 6; case 24000: return 7;
+        case 32000: return 8; case 44100: return 9; case 48000: return 10; case 96000: return 11;
+        default: return 0;   // Taken from STREAMINFO
+    }
+}
+
+// Encodes one frame, trying independent, left/side, right/side and mid/side stereo
+static std::vector<u8> EncodeFrame(const s32* left, const s32* right, int n, int bps, int sample_rate, u32 frame_number, int block_size) {
+    std::vector<s32> mid(n), side(n);
+    for (int i = 0; i < n; i++) {
+        mid[i] = (left[i] + right[i]) >> 1;
+        side[i] = left[i] - right[i];
+    }
+    SubframePlan pl = PlanSubframe(left, n, bps);
+    SubframePlan pr = PlanSubframe(right, n, bps);
+    SubframePlan pm = PlanSubframe(mid.data(), n, bps);
+    SubframePlan ps = PlanSubframe(side.data(), n, bps + 1);
+
+    u64 costs[4] = { pl.bits + pr.bits, pl.bits + ps.bits, ps.bits + pr.bits, pm.bits + ps.bits };
+    int mode = (int)(std::min_element(costs, costs + 4) - costs);
+
+    BitWriter bw;
+    bw.put(0x3FFE, 14);
+    bw.put(0, 1);
+    bw.put(0, 1);   // Fixed block size
+    bw.put(n == block_size ? 12 : 7, 4);
+    bw.put(SampleRateCode(sample_rate), 4);
+    bw.put(mode == 0 ? 1 : 7 + mode, 4);
+    bw.put(bps == 24 ? 6 : 4, 3);
+    bw.put(0, 1);
+    bw.put_utf8(frame_number);
+    if (n != block_size) bw.put(n - 1, 16);
+    bw.put(Crc8(bw.bytes.data(), bw.bytes.size()), 8);
+
+    switch (mode) {
+        case 0: WriteSubframe(bw, pl, left, n, bps); WriteSubframe(bw, pr, right, n, bps); break;
+        case 1: WriteSubframe(bw, pl, left, n, bps); WriteSubframe(bw, ps, side.data(), n, bps + 1); break;
+        case 2: WriteSubframe(bw, ps, side.data(), n, bps + 1); WriteSubframe(bw, pr, right, n, bps); break;
+        default: WriteSubframe(bw, pm, mid.data(), n, bps); WriteSubframe(bw, ps, side.data(), n, bps + 1); break;
+    }
+    bw.align();
+    u16 crc = Crc16(bw.bytes.data(), bw.bytes.size());
+    bw.put(crc, 16);
+    return std::move(bw.bytes);
+}
+
+FlacSink::FlacSink(SampleFormat format, int threads)
+    : m_bits(format == SampleFormat::Pcm16 ? 16 : 24),
+      m_threads(threads > 0 ? threads : (int)std::max(1u, std::thread::hardware_concurrency())) {}
+
+void FlacSink::write_streaminfo() {
+    BitWriter bw;
+    bw.put(0x80, 8);    // Last metadata block, STREAMINFO
+    bw.put(34, 24);
+    bw.put(kBlockSize, 16);
+    bw.put(kBlockSize, 16);
+    bw.put(m_min_frame, 24);
+    bw.put(m_max_frame, 24);
+    bw.put((u32)m_sample_rate, 20);
+    bw.put(1, 3);       // Two channels
+    bw.put(m_bits - 1, 5);
+    bw.put((u32)(m_total >> 32), 4);
+    bw.put((u32)m_total, 32);
+    for (int i = 0; i < 4; i++) bw.put(0, 32);  // No MD5
+    m_file.write((const char*)bw.bytes.data(), bw.bytes.size());
+}
+
+bool FlacSink::open(const std::string& path, int sample_rate) {
+    m_file.open(path, std::ios::binary);
+    if (!m_file.is_open()) return false;
+    m_sample_rate = sample_rate;
+    m_total = 0;
+    m_frame_number = 0;
+    m_min_frame = 0;
+    m_max_frame = 0;
+    m_left.clear();
+    m_right.clear();
+    m_file.write("fLaC", 4);
+    write_streaminfo();
+    return m_file.good();
+}
+
+bool FlacSink::write(const float* left, const float* right, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (m_bits == 16) {
+            m_left.push_back(to_pcm16(left[i]));
+            m_right.push_back(to_pcm16(right[i]));
+        } else {
+            m_left.push_back(to_pcm24(left[i]));
+            m_right.push_back(to_pcm24(right[i]));
+        }
+    }
+    m_total += count;
+    if (m_left.size() >= (size_t)kBlockSize * kBatchBlocks) return flush(false);
+    return true;
+}
+
+// Encodes every complete block (and on the final flush the remainder) across the worker
+// threads, then writes the frames in order.
+bool FlacSink::flush(bool final) {
+    size_t blocks = m_left.size() / kBlockSize;
+    if (final && m_left.size() % kBlockSize) blocks++;
+    if (blocks == 0) return true;
+
+    std::vector<std::vector<u8>> frames(blocks);
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        size_t b;
+        while ((b = next++) < blocks) {
+            size_t start = b * kBlockSize;
+            int n = (int)std::min<size_t>(kBlockSize, m_left.size() - start);
+            frames[b] = EncodeFrame(m_left.data() + start, m_right.data() + start, n, m_bits, m_sample_rate, m_frame_number + (u32)b, kBlockSize);
+        }
+    };
+    int extra = std::min<int>(m_threads, (int)blocks) - 1;
+    std::vector<std::thread> pool;
+    for (int t = 0; t < extra; t++) pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool) t.join();
+
+    for (const auto& f : frames) {
+        u32 size = (u32)f.size();
+        m_min_frame = m_min_frame ? std::min(m_min_frame, size) : size;
+        m_max_frame = std::max(m_max_frame, size);
+        m_file.write((const char*)f.data(), f.size());
+    }
+    m_frame_number += (u32)blocks;
+
+    size_t used = std::min(m_left.size(), blocks * kBlockSize);
+    m_left.erase(m_left.begin(), m_left.begin() + used);
+    m_right.erase(m_right.begin(), m_right.begin() + used);
+    return m_file.good();
+}
+
+bool FlacSink::close() {
+    if (!m_file.is_open()) return false;
+    bool ok = flush(true);
+    m_file.seekp(4);
+    write_streaminfo();
+    ok = ok && m_file.good();
+    m_file.close();
+    return ok;
+}
@@ -0,0 +1,37 @@
+#ifndef FLACSINK_H
+#define FLACSINK_H
+
+#include "audiosink.h"
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Streams a stereo FLAC file. Frames use fixed or LPC prediction with Rice coded residuals,
+// pick the cheapest stereo decorrelation, and are encoded in parallel batches.
+// FLAC has no float samples, so Float32 is stored as 24-bit.
+class FlacSink : public AudioSink {
+public:
+    explicit FlacSink(SampleFormat format = SampleFormat::Pcm16, int threads = 0);
+
+    bool open(const std::string& path, int sample_rate) override;
+    bool write(const float* left, const float* right, size_t count) override;
+    bool close() override;
+
+private:
+    static constexpr int kBlockSize = 4096;
+    static constexpr int kBatchBlocks = 32;   // Blocks buffered before a parallel encode
+
+    bool flush(bool final);
+    void write_streaminfo();
+
+    int m_bits;
+    int m_threads;
+    std::ofstream m_file;
+    int m_sample_rate = 44100;
+    std::vector<s32> m_left, m_right;   // Samples not encoded yet
+    u64 m_total = 0;
+    u32 m_frame_number = 0;
+    u32 m_min_frame = 0, m_max_frame = 0;
+};
+
+#endif // FLACSINK_H
@@ -0,0 +1,100 @@
+#include "renderpipeline.h"
+#include <chrono>
+
+// Attempts before a stage sleeps; roughly a few microseconds
+static const int kSpinCount = 4000;
+
+static double Now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+RenderPipeline::RenderPipeline(MixStage mix, AudioSink* sink) : m_mix(std::move(mix)), m_sink(sink), m_start_time(Now()) {
+    m_mix_thread = std::thread(&RenderPipeline::mix_loop, this);
+    m_write_thread = std::thread(&RenderPipeline::write_loop, this);
+}
+
+RenderPipeline::~RenderPipeline() { finish(); }
+
+template <typename Op>
+void RenderPipeline::wait_until(Op op) {
+    for (int spin = 0; spin < kSpinCount; spin++) {
+        if (op()) return;
+    }
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_sleepers.fetch_add(1);
+    // Pairs with the fence in moved(): either it sees this sleeper or op sees its block
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    m_moved.wait(lock, op);
+    m_sleepers.fetch_sub(1);
+}
+
+void RenderPipeline::moved() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleepers.load(std::memory_order_relaxed) == 0) return;
+    // Taking the lock means a sleeper is either waiting already or yet to test op
+    { std::lock_guard<std::mutex> lock(m_mutex); }
+    m_moved.notify_all();
+}
+
+void RenderPipeline::send(PipelineBlock&& block) {
+    if (!m_to_mix.try_push(std::move(block))) {
+        double wait_start = Now();
+        wait_until([&] { return m_to_mix.try_push(std::move(block)); });
+        m_wait_seconds += Now() - wait_start;
+    }
+    moved();
+}
+
+void RenderPipeline::push(const float* dl, const float* dr, const float* wl, const float* wr, size_t count) {
+    PipelineBlock block;
+    m_free.try_pop(block);
+    block.dl.assign(dl, dl + count);
+    block.dr.assign(dr, dr + count);
+    block.wl.assign(wl, wl + count);
+    block.wr.assign(wr, wr + count);
+    block.last = false;
+    send(std::move(block));
+}
+
+bool RenderPipeline::finish() {
+    if (m_finished) return m_written;
+    m_finished = true;
+    PipelineBlock end;
+    end.last = true;
+    send(std::move(end));
+    m_synth_seconds = Now() - m_start_time - m_wait_seconds;
+    m_mix_thread.join();
+    m_write_thread.join();
+    return m_written;
+}
+
+void RenderPipeline::mix_loop() {
+    PipelineBlock block;
+    for (;;) {
+        wait_until([&] { return m_to_mix.try_pop(block); });
+        moved();
+        bool last = block.last;
+        if (!last) {
+            double start = Now();
+            m_mix(block);
+            m_mix_seconds += Now() - start;
+        }
+        wait_until([&] { return m_to_write.try_push(std::move(block)); });
+        moved();
+        if (last) return;
+    }
+}
+
+void RenderPipeline::write_loop() {
+    PipelineBlock block;
+    for (;;) {
+        wait_until([&] { return m_to_write.try_pop(block); });
+        moved();
+        if (block.last) return;
+        double start = Now();
+        if (m_written) m_written = m_sink->write(block.dl.data(), block.dr.data(), block.dl.size());
+        m_write_seconds += Now() - start;
+        // Full means synthesis already has plenty to reuse
+        m_free.try_push(std::move(block));
+    }
+}
@@ -0,0 +1,97 @@
+#ifndef RENDERPIPELINE_H
+#define RENDERPIPELINE_H
+
+#include "../common.h"
+#include "audiosink.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Bounded single-producer single-consumer ring. Never blocks; callers decide how to wait.
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) : m_slots(capacity + 1) {}
+
+    bool try_push(T&& item) {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t next = (tail + 1) % m_slots.size();
+        if (next == m_head.load(std::memory_order_acquire)) return false;
+        m_slots[tail] = std::move(item);
+        m_tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T& item) {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) return false;
+        item = std::move(m_slots[head]);
+        m_head.store((head + 1) % m_slots.size(), std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> m_slots;
+    alignas(64) std::atomic<size_t> m_head{0};  // Next slot to pop, advanced by the consumer
+    alignas(64) std::atomic<size_t> m_tail{0};  // Next slot to fill, advanced by the producer
+};
+
+// One block on its way through the pipeline. The mix stage leaves its result in dl/dr.
+struct PipelineBlock {
+    std::vector<float> dl, dr, wl, wr;
+    bool last = false;
+};
+
+// Runs a render as three overlapping stages: synthesis on the calling thread, reverb and the
+// master mix on a second thread, and sample conversion, encoding and writing on a third.
+// Blocks are recycled back to the synthesis stage once written. A stage that finds its
+// queue empty or full spins briefly, then sleeps until another stage moves a block.
+class RenderPipeline {
+public:
+    using MixStage = std::function<void(PipelineBlock&)>;
+
+    RenderPipeline(MixStage mix, AudioSink* sink);
+    ~RenderPipeline();
+
+    // Synthesis stage output; waits while the next stage is kQueueBlocks behind
+    void push(const float* dl, const float* dr, const float* wl, const float* wr, size_t count);
+    // Drains the stages and returns whether every write succeeded
+    bool finish();
+
+    // Busy time of each stage, without time spent waiting on the others
+    double synth_seconds() const { return m_synth_seconds; }
+    double mix_seconds() const { return m_mix_seconds; }
+    double write_seconds() const { return m_write_seconds; }
+
+private:
+    static constexpr size_t kQueueBlocks = 16;
+
+    void send(PipelineBlock&& block);
+    // Retries op until it succeeds, spinning first and then sleeping between attempts
+    template <typename Op> void wait_until(Op op);
+    // Wakes sleeping stages after a block moved through a queue
+    void moved();
+    void mix_loop();
+    void write_loop();
+
+    MixStage m_mix;
+    AudioSink* m_sink;
+    SpscQueue<PipelineBlock> m_to_mix{kQueueBlocks};
+    SpscQueue<PipelineBlock> m_to_write{kQueueBlocks};
+    SpscQueue<PipelineBlock> m_free{kQueueBlocks * 2 + 2};
+    std::thread m_mix_thread, m_write_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_moved;
+    std::atomic<int> m_sleepers{0};
+    bool m_written = true;
+    bool m_finished = false;
+
+    double m_start_time;
+    double m_wait_seconds = 0.0;
+    double m_synth_seconds = 0.0, m_mix_seconds = 0.0, m_write_seconds = 0.0;
+};
+
+#endif // RENDERPIPELINE_H
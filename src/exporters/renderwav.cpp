@@ -1,425 +1,402 @@
 #include "renderwav.h"
-#include "../engine/audio.h"
-#include "../engine/adsr.h"
+#include "../engine/synth.h"
+#include "../engine/sequencer.h"
+#include "../engine/reverb.h"
+#include "../engine/bankcache.h"
+#include "seqstats.h"
+#include "audiosink.h"
+#include "flacsink.h"
+#include "renderpipeline.h"
 #include "../format/sq.h"
 #include "../format/mid.h"
-#include "../engine/vibrato.h"
-#include "../engine/reverb.h"
 #include <fstream>
 #include <algorithm>
 #include <cmath>
 #include <cstring>
+#include <cctype>
 #include <iostream>
-#include <map>
-
-struct WavHeader {
-    char riff[4] = {'R','I','F','F'};
-    u32 overall_size;
-    char wave[4] = {'W','A','V','E'};
-    char fmt[4] = {'f','m','t',' '};
-    u32 fmt_length = 16;
-    u16 format_type = 1;
-    u16 channels = 2;
-    u32 sample_rate = 44100;
-    u32 byte_rate = 44100 * 4;
-    u16 block_align = 4;
-    u16 bits_per_sample = 16;
-    char data[4] = {'d','a','t','a'};
-    u32 data_size;
-};
-
-class FastNoise {
-    uint32_t state = 0xA491;
-public:
-    inline int16_t next() {
-        uint32_t x = state;
-        x ^= x << 13; x ^= x >> 17; x ^= x << 5;
-        state = x;
-        return (int16_t)(x & 0xFFFF);
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+static bool HasExtension(const std::string& path, const char* ext) {
+    size_t len = std::strlen(ext);
+    if (path.size() < len) return false;
+    for (size_t i = 0; i < len; i++) {
+        if (std::tolower((unsigned char)path[path.size() - len + i]) != ext[i]) return false;
     }
-};
-
-struct SynthVoice {
-    DecodedSample data;
-    double pos = 0.0;
-    double base_pitch_mult = 1.0;
-    double target_pitch_mult = 1.0;
-    double portamento_step = 1.0;
-    double note_base_freq = 1.0;
-    bool sliding = false;
-    float base_vol_factor = 0.0f;
-    int tone_pan = 64;
-    int ch = 0; int note_key = 0; bool active = false; bool reverb_on = false;
-    std::shared_ptr<HardwareADSR> adsr; bool release_pending = false;
-
-    VibratoEngine vibrato;
-    bool vibrato_enabled = false;
-    double vibrato_rate_val = 0.0;
-    double vibrato_depth_rate_val = 0.0;
-
-    bool noise_mode = false;
-};
-
-class SynthEngine {
-public:
-    struct ChannelState {
-        int prog = 0; double pitch_bend_factor = 1.0; double pitch_mult = 12.0;
-        int vol = 127, expr = 127, pan = 64, reverb_depth = 0;
-        int attack_mod = 64, release_mod = 64;
-        bool sustain_active = false; bool portamento_active = false; int portamento_time = 0;
-        int rpn_msb = 127, rpn_lsb = 127, nrpn_msb = 127, nrpn_lsb = 127;
-        int modulation = 0; int breath_rate = 0;
-        bool lfo_enabled = false; float lfo_rate = 5.0f; float lfo_depth = 0.0f;
-        float lfo_phase = 0.0f; float lfo_sensitivity = 0.0f; double last_note_pitch = -1.0;
-        void reset_controllers() {
-            vol = 127; expr = 127; pan = 64;
-            pitch_bend_factor = 1.0;
-            sustain_active = false; portamento_active = false;
-            lfo_enabled = false; lfo_depth = 0.0f; modulation = 0;
-        }
-        double get_lfo_ratio(float sample_rate) {
-            if (!lfo_enabled || lfo_depth <= 0.0001f) return 1.0;
-            lfo_phase += (lfo_rate * 6.283185307f) / sample_rate;
-            if (lfo_phase > 6.283185307f) lfo_phase -= 6.283185307f;
-            float val = std::sin(lfo_phase) * lfo_depth * lfo_sensitivity;
-            return std::pow(2.0, val / 12.0);
-        }
-    };
-
-    ChannelState channels[16];
-    ReverbEngine reverb;
-    std::vector<SynthVoice> active_voices;
-    std::map<u32, DecodedSample> sample_cache;
-
-    BDParser* bd = nullptr;
-    HDParser* hd = nullptr;
+    return true;
+}
 
-    SynthEngine() { reverb.init_studio_large(); }
+using BlockSink = std::function<void(const float* dl, const float* dr, const float* wl, const float* wr, size_t count)>;
 
-    void set_data(BDParser* _bd, HDParser* _hd) { bd = _bd; hd = _hd; }
+// Gaps between events are rendered in blocks of at most this many samples, so every buffer
+// along the way keeps a fixed size once the first block has been through
+static const int kBlockSamples = 1024;
 
-    void note_on(int ch_idx, int note, int vel) {
-        if (!hd || !bd) return;
-        ChannelState& ch = channels[ch_idx];
-        if (ch.prog >= hd->programs.size() || !hd->programs[ch.prog]) return;
-        auto prog = hd->programs[ch.prog];
+// Renders from the sequencer's current position up to end_sample, optionally followed by
+// a two second release tail, handing every block to sink.
+static void RenderUntil(SynthEngine& spu, Sequencer& sequencer, u64 end_sample, bool tail, const BlockSink& sink, const std::function<void(size_t)>& onEvent) {
+    std::vector<float> dl, dr, wl, wr;
+    for (auto* buf : {&dl, &dr, &wl, &wr}) buf->reserve(kBlockSamples);
+    while (sequencer.position() < end_sample) {
+        if (onEvent) onEvent(sequencer.bytes_read());
 
-        if (prog->is_sfx) return;
+        int avail = sequencer.advance();
+        if (avail <= 0) break;
 
-        ch.lfo_phase = 0.0f;
+        int num_samples = (int)std::min<u64>((u64)std::min(avail, kBlockSamples), end_sample - sequencer.position());
+        spu.render_block(num_samples, dl, dr, wl, wr);
+        sink(dl.data(), dr.data(), wl.data(), wr.data(), num_samples);
+        sequencer.consume(num_samples);
+    }
 
-        std::vector<const Tone*> targets;
-        for (const auto& tone : prog->tones) {
-            if (note >= tone.min_note && note <= tone.max_note) {
-                targets.push_back(&tone);
-                if (!prog->is_layered && !prog->is_sfx) break;
-            }
+    if (tail) {
+        for (int left = spu.sample_rate * 2; left > 0; left -= kBlockSamples) {
+            int num_samples = std::min(left, kBlockSamples);
+            spu.render_block(num_samples, dl, dr, wl, wr);
+            sink(dl.data(), dr.data(), wl.data(), wr.data(), num_samples);
         }
+    }
+}
 
-        if (targets.empty()) return;
-
-        for (const Tone* target_tone : targets) {
-            if (target_tone->is_noise()) continue;
+// Data and settings every engine of one render is configured with
+struct EngineSetup {
+    HDParser* hd;
+    BDParser* bd;
+    const SampleBank* samples;
+    EnvelopeCache* envelopes;
+    Interpolation interpolation;
+    PanLaw pan_law;
+    int sample_rate;
+    float cull_threshold;
+
+    void apply(SynthEngine& spu) const {
+        spu.set_data(bd, hd);
+        spu.set_samples(samples);
+        spu.set_envelopes(envelopes);
+        spu.set_interpolation(interpolation);
+        spu.set_pan_law(pan_law);
+        spu.set_sample_rate(sample_rate);
+        spu.set_cull_threshold(cull_threshold);
+    }
+};
 
-            if (target_tone->use_prog_pitch()) {
-                if (prog->pitch_mult != 0) ch.pitch_mult = (double)prog->pitch_mult;
-            } else {
-                if (target_tone->pitch_mult != 0) ch.pitch_mult = (double)target_tone->pitch_mult;
-            }
-            ch.lfo_sensitivity = ch.pitch_mult / 128.0f;
+// Voice counts summed over every engine that took part in a render
+struct VoiceCounts {
+    u64 rendered = 0;
+    u64 culled = 0;
+    u64 retired = 0;
 
-            if (sample_cache.find(target_tone->bd_offset) == sample_cache.end()) {
-                auto raw = bd->get_adpcm_block(target_tone->bd_offset);
-                if (!raw.empty()) sample_cache[target_tone->bd_offset] = EngineUtils::decode_adpcm(raw);
-                else sample_cache[target_tone->bd_offset] = DecodedSample();
-            }
-            DecodedSample& smp = sample_cache[target_tone->bd_offset];
-            if (smp.pcm.empty() && !target_tone->is_noise()) continue;
-
-            double root = (target_tone->root_key > 0) ? target_tone->root_key : 60;
-            double fine = target_tone->pitch_fine / 20.0;
-            double base_pitch = std::pow(2.0, (note - (root - fine)) / 12.0);
-
-            u32 reg_combined = ((u32)target_tone->adsr2 << 16) | (u32)target_tone->adsr1;
-            auto adsr = std::make_shared<HardwareADSR>(reg_combined);
-            adsr->KeyOn();
-
-            SynthVoice v;
-            v.data = smp; v.pos = 0.0; v.note_base_freq = base_pitch;
-            v.base_pitch_mult = 1.0; v.target_pitch_mult = 1.0; v.noise_mode = target_tone->is_noise();
-
-            if (ch.portamento_active && ch.last_note_pitch > 0.0) {
-                v.base_pitch_mult = ch.last_note_pitch / v.note_base_freq;
-                v.sliding = true;
-                float slide_time = 0.01f + (ch.portamento_time / 127.0f);
-                float num_samples = slide_time * 44100.0f;
-                if (num_samples < 1.0f) num_samples = 1.0f;
-                v.portamento_step = std::pow(v.target_pitch_mult / v.base_pitch_mult, 1.0 / num_samples);
-            } else {
-                v.sliding = false; v.portamento_step = 1.0;
-            }
-            ch.last_note_pitch = v.note_base_freq * v.target_pitch_mult;
+    void add(const SynthEngine& spu) {
+        rendered += spu.voice_samples;
+        culled += spu.culled_samples;
+        retired += spu.voices_retired;
+    }
+};
 
-            if (target_tone->use_modulation()) {
-                int breath_idx = -1;
-                if (target_tone->use_prog_breath()) breath_idx = prog->breath_idx; else breath_idx = target_tone->breath_idx;
+// Reports render progress in tenths of a percent, skipping repeats
+struct ProgressReporter {
+    std::function<void(int, int)> callback;
+    int last = -1;
 
-                const float max_vibrato_depth_semitones = 0.5f; // modest depth
-                float depth_norm = ch.modulation / 127.0f;
-                v.vibrato.depth = depth_norm * max_vibrato_depth_semitones;
+    void report(int permille) {
+        if (callback && permille != last) {
+            last = permille;
+            callback(permille, 1000);
+        }
+    }
+};
 
-                const std::vector<u8>* depth_wave = nullptr;
-                if (breath_idx != 0xFF && breath_idx != 0x7F && breath_idx < hd->breath_scripts.size()) {
-                    depth_wave = &hd->breath_scripts[breath_idx];
-                }
+// Share of a parallel render's progress given to the checkpoint scan
+static const int kScanPermille = 100;
 
-                v.vibrato.init({}, depth_wave ? *depth_wave : std::vector<u8>{}, 0, 0);
-                v.vibrato_enabled = v.vibrato.active && v.vibrato.depth > 0.0f;
+// Fast-forwards through the whole sequence and returns checkpoints at gap boundaries where
+// every voice has finished. Rendering from such a point reproduces the serial output exactly.
+static std::vector<Sequencer::Checkpoint> FindSilentCheckpoints(SeqInterface* seq, const EngineSetup& setup, int loop_count, u64 end_sample, u64 min_spacing, u64& length, ProgressReporter& progress) {
+    SynthEngine spu;
+    setup.apply(spu);
+    Sequencer sequencer(seq, &spu);
+    sequencer.set_sample_rate(setup.sample_rate);
+    sequencer.set_loop_count(loop_count);
+    size_t total_bytes = std::max<size_t>(sequencer.bytes_total(), 1);
+
+    std::vector<Sequencer::Checkpoint> points;
+    points.push_back(sequencer.checkpoint());
+    while (sequencer.position() < end_sample) {
+        progress.report((int)(std::min(sequencer.bytes_read(), total_bytes) * kScanPermille / total_bytes));
+        if (sequencer.position() - points.back().position >= min_spacing && spu.idle()) {
+            points.push_back(sequencer.checkpoint());
+        }
+        int avail = sequencer.advance();
+        if (avail <= 0) break;
+        int num_samples = (int)std::min<u64>((u64)avail, end_sample - sequencer.position());
+        spu.fast_forward(num_samples);
+        sequencer.consume(num_samples);
+    }
+    length = sequencer.position();
+    return points;
+}
 
-                if (v.vibrato_enabled) {
-                    float rate_factor = (ch.breath_rate > 0 ? ch.breath_rate : 64) / 127.0f;
-                    double target_hz = 0.5 + (rate_factor * 9.5);
+// One segment's output, filled in by a worker and streamed out by the calling thread
+struct SegmentBuffers {
+    std::vector<float> dl, dr, wl, wr;
+    bool ready = false;
+};
 
-                    size_t wave_size = v.vibrato.lfo_table.empty() ? 256 : v.vibrato.lfo_table.size();
-                    size_t depth_size = v.vibrato.depth_table.empty() ? wave_size : v.vibrato.depth_table.size();
-                    v.vibrato_rate_val = (double)wave_size * target_hz / 44100.0;
-                    v.vibrato_depth_rate_val = (double)depth_size * target_hz / 44100.0;
-                }
-            }
+// Splits the timeline at silent checkpoints and renders the segments on separate engines, each
+// without mix threads, so the result matches a single-threaded serial render sample for sample.
+// The calling thread hands the segments to mix in order as they finish, and workers stay at
+// most a few segments ahead of it. Reverb is stateful across segments, so it runs in mix.
+// With mismatches set, every segment is also rendered serially and compared, and the count
+// of differing samples is added to it.
+static bool RenderParallel(SeqInterface* seq, const EngineSetup& setup, int threads, int loop_count, u64 end_sample, bool tail, const BlockSink& mix, ProgressReporter& progress, VoiceCounts& counts, u64* mismatches) {
+    // Checkpoints are at least a second apart, so anything shorter is a single segment. A
+    // timing-only pass finds that out without fast-forwarding every voice through the song.
+    u64 min_spacing = (u64)setup.sample_rate;
+    Sequencer timing(seq, nullptr);
+    timing.set_sample_rate(setup.sample_rate);
+    timing.set_loop_count(loop_count);
+    while (timing.position() <= min_spacing && timing.position() < end_sample) {
+        int n = timing.advance();
+        if (n <= 0) break;
+        timing.consume(n);
+    }
+    if (timing.position() <= min_spacing || end_sample <= min_spacing) return false;
 
-            v.tone_pan = Util::clamp_pan(target_tone->pan + (int)prog->master_pan - 64);
-            v.base_vol_factor = (target_tone->vol / 127.0f) * (prog->master_vol / 127.0f) * (vel / 127.0f);
-            v.ch = ch_idx; v.note_key = note; v.active = true; v.reverb_on = target_tone->is_reverb(); v.adsr = adsr;
+    u64 length = 0;
+    auto points = FindSilentCheckpoints(seq, setup, loop_count, end_sample, min_spacing, length, progress);
 
-            active_voices.push_back(v);
-        }
+    // A few segments per thread keep the workers busy when the split points are uneven
+    u64 spacing = length / ((u64)threads * 4);
+    std::vector<Sequencer::Checkpoint> splits;
+    for (const auto& cp : points) {
+        if (splits.empty() || cp.position - splits.back().position >= spacing) splits.push_back(cp);
     }
-
-    void note_off(int ch_idx, int note) {
-        for (auto& v : active_voices) {
-            if (v.ch == ch_idx && v.note_key == note) {
-                if (channels[ch_idx].sustain_active) v.release_pending = true;
-                else v.adsr->KeyOff();
+    if (splits.size() < 2) return false;
+
+    std::vector<SegmentBuffers> segments(splits.size());
+    size_t window = (size_t)threads * 2;
+    size_t next_segment = 0, streamed = 0;
+    std::mutex mutex;
+    std::condition_variable changed;    // A segment finished, or one was streamed and freed
+
+    auto worker = [&]() {
+        SynthEngine spu;
+        setup.apply(spu);
+        Sequencer sequencer(seq, &spu);
+        sequencer.set_sample_rate(setup.sample_rate);
+        sequencer.set_loop_count(loop_count);
+        for (;;) {
+            size_t i;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return next_segment == splits.size() || next_segment < streamed + window; });
+                if (next_segment == splits.size()) break;
+                i = next_segment++;
             }
+            bool last = (i + 1 == splits.size());
+            u64 segment_end = last ? end_sample : splits[i + 1].position;
+            SegmentBuffers& out = segments[i];
+
+            sequencer.restore(splits[i]);
+            RenderUntil(spu, sequencer, segment_end, last && tail, [&out](const float* dl, const float* dr, const float* wl, const float* wr, size_t count) {
+                out.dl.insert(out.dl.end(), dl, dl + count);
+                out.dr.insert(out.dr.end(), dr, dr + count);
+                out.wl.insert(out.wl.end(), wl, wl + count);
+                out.wr.insert(out.wr.end(), wr, wr + count);
+            }, nullptr);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            out.ready = true;
+            changed.notify_all();
         }
-    }
+        std::lock_guard<std::mutex> lock(mutex);
+        counts.add(spu);
+    };
 
-    void program_change(int ch_idx, int prog_id) { channels[ch_idx].prog = prog_id; }
-    void pitch_bend(int ch_idx, int val) {
-        double mult = channels[ch_idx].pitch_mult;
-        channels[ch_idx].pitch_bend_factor = std::pow(2.0, (((val - 64) / 64.0) * mult) / 12.0);
+    std::vector<std::thread> pool;
+    int workers = std::min<int>(threads, (int)splits.size());
+    for (int t = 0; t < workers; t++) pool.emplace_back(worker);
+
+    // Serial reference for verification, advanced one segment at a time alongside the output
+    std::unique_ptr<SynthEngine> check;
+    std::unique_ptr<Sequencer> check_sequencer;
+    if (mismatches) {
+        check = std::make_unique<SynthEngine>();
+        setup.apply(*check);
+        check_sequencer = std::make_unique<Sequencer>(seq, check.get());
+        check_sequencer->set_sample_rate(setup.sample_rate);
+        check_sequencer->set_loop_count(loop_count);
     }
 
-    void control_change(int ch_idx, int cc, int val) {
-        ChannelState& ch = channels[ch_idx];
-        switch(cc) {
-            case 7: ch.vol = val; break;
-            case 11: ch.expr = val; break;
-            case 10: ch.pan = val; break;
-            case 91: ch.reverb_depth = val; break;
-            case 1: ch.modulation = val; ch.lfo_depth = val/127.0f; break;
-            case 64: ch.sustain_active = (val >= 64);
-            if(!ch.sustain_active) {
-                for(auto& v : active_voices) if(v.ch == ch_idx && v.release_pending) v.adsr->KeyOff();
-            }
-            break;
-            case 65: ch.portamento_active = (val >= 64); break;
-            case 5: ch.portamento_time = val; break;
-            case 121: ch.reset_controllers(); break;
+    u64 out_samples = 0;
+    for (size_t i = 0; i < segments.size(); i++) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return segments[i].ready; });
         }
-    }
-
-    void render_block(int num_samples, std::vector<float>& dl, std::vector<float>& dr, std::vector<float>& wl, std::vector<float>& wr, float samples_per_tick) {
-        dl.assign(num_samples, 0.0f); dr.assign(num_samples, 0.0f);
-        wl.assign(num_samples, 0.0f); wr.assign(num_samples, 0.0f);
-
-        active_voices.erase(std::remove_if(active_voices.begin(), active_voices.end(), [](const SynthVoice& v) { return !v.active; }), active_voices.end());
-
-        static FastNoise noise_gen;
-
-        for (int i = 0; i < num_samples; i++) {
-            double mod_ratios[16];
-            for(int c=0; c<16; c++) mod_ratios[c] = channels[c].get_lfo_ratio(44100.0f);
-
-            for (auto& v : active_voices) {
-                if (!v.active) continue;
-                ChannelState& ch = channels[v.ch];
-
-                s16 adsr_vol = v.adsr->Tick();
-                if (v.adsr->phase == HardwareADSR::Phase::Off) { v.active = false; continue; }
-
-                if (v.sliding) {
-                    v.base_pitch_mult *= v.portamento_step;
-                    if ((v.portamento_step > 1.0 && v.base_pitch_mult >= v.target_pitch_mult) ||
-                        (v.portamento_step < 1.0 && v.base_pitch_mult <= v.target_pitch_mult)) {
-                        v.base_pitch_mult = v.target_pitch_mult;
-                    v.sliding = false;
-                        }
-                }
-
-                float vibrato_pitch_offset = 0.0f;
-                if (v.vibrato_enabled) {
-                    double depth_step = v.vibrato_depth_rate_val > 0.0 ? v.vibrato_depth_rate_val : v.vibrato_rate_val;
-                    v.vibrato.tick(v.vibrato_rate_val, depth_step);
-                    vibrato_pitch_offset = v.vibrato.get_pitch_offset();
+        SegmentBuffers& seg = segments[i];
+        bool last = (i + 1 == splits.size());
+
+        if (check) {
+            size_t at = 0;
+            u64 segment_end = last ? end_sample : splits[i + 1].position;
+            RenderUntil(*check, *check_sequencer, segment_end, last && tail, [&](const float* dl, const float* dr, const float* wl, const float* wr, size_t count) {
+                for (size_t k = 0; k < count; k++, at++) {
+                    if (at >= seg.dl.size() || dl[k] != seg.dl[at] || dr[k] != seg.dr[at] || wl[k] != seg.wl[at] || wr[k] != seg.wr[at]) (*mismatches)++;
                 }
+            }, nullptr);
+            if (at < seg.dl.size()) *mismatches += seg.dl.size() - at;
+        }
 
-                double vib_factor = std::pow(2.0, vibrato_pitch_offset / 12.0);
-                if (std::isnan(vib_factor) || std::isinf(vib_factor)) vib_factor = 1.0;
-
-                double effective_pitch = v.note_base_freq * v.base_pitch_mult * vib_factor * ch.pitch_bend_factor * mod_ratios[v.ch];
-                if (effective_pitch < 0.0) effective_pitch = 0.0;
-
-                float samp_val = 0.0f;
-
-                if (v.noise_mode) {
-                    v.pos += effective_pitch;
-                    if (v.pos >= 1.0) { samp_val = (float)noise_gen.next(); v.pos -= 1.0; }
-                    else samp_val = (float)noise_gen.next();
-                } else {
-                    int pos_i = (int)v.pos; double frac = v.pos - pos_i;
-                    s16 s0 = 0, s1 = 0;
-                    if (pos_i < v.data.pcm.size()) s0 = v.data.pcm[pos_i];
-                    int next_pos = v.data.looping && v.data.loop_end > v.data.loop_start
-                    ? (pos_i + 1 >= v.data.loop_end ? v.data.loop_start + (pos_i + 1 - v.data.loop_end) : pos_i + 1) : pos_i + 1;
-                    if (next_pos < v.data.pcm.size()) s1 = v.data.pcm[next_pos];
-                    samp_val = s0 + (s1 - s0) * frac;
-                    v.pos += effective_pitch;
-
-                    if (v.data.looping && v.data.loop_end > v.data.loop_start) {
-                        double loop_len = v.data.loop_end - v.data.loop_start;
-                        while (v.pos >= v.data.loop_end) v.pos -= loop_len;
-                    } else if (v.pos >= v.data.pcm.size()) {
-                        v.active = false; continue;
-                    }
-                }
-
-                float vol = (samp_val / 32768.0f) * (adsr_vol / 32767.0f) * v.base_vol_factor * (ch.vol / 127.0f) * (ch.expr / 127.0f);
-                int eff_pan = Util::clamp_pan(v.tone_pan + (ch.pan - 64));
-                float pan_val = eff_pan / 127.0f;
-                float l = vol * std::sqrt(1.0f - pan_val);
-                float r = vol * std::sqrt(pan_val);
-
-                if (std::isnan(l)) l = 0.0f; if (std::isnan(r)) r = 0.0f;
-                dl[i] += l; dr[i] += r;
-
-                if (v.reverb_on) {
-                    float send = vol * (ch.reverb_depth / 127.0f) * 0.707f;
-                    if (std::isnan(send)) send = 0.0f;
-                    wl[i] += send; wr[i] += send;
-                }
-            }
+        for (size_t at = 0; at < seg.dl.size(); at += kBlockSamples) {
+            size_t count = std::min<size_t>(kBlockSamples, seg.dl.size() - at);
+            mix(seg.dl.data() + at, seg.dr.data() + at, seg.wl.data() + at, seg.wr.data() + at, count);
+            out_samples += count;
+            progress.report(kScanPermille + (int)(std::min(out_samples, length) * (1000 - kScanPermille) / std::max<u64>(length, 1)));
         }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        seg = SegmentBuffers();
+        streamed = i + 1;
+        changed.notify_all();
     }
-};
+    for (auto& t : pool) t.join();
+    return true;
+}
 
-bool ExportSequenceToWav(const std::string& sqPath, const std::string& wavPath, HDParser* hd, BDParser* bd, bool useReverb, bool isMidi, std::function<void(int, int)> progressCallback) {
+bool ExportSequenceToWav(const std::string& sqPath, const std::string& wavPath, HDParser* hd, BDParser* bd, bool useReverb, bool isMidi, std::function<void(int, int)> progressCallback, const RenderOptions& options) {
     std::shared_ptr<SeqInterface> seq;
     if (isMidi) seq = std::make_shared<MidiParser>();
     else seq = std::make_shared<SQParser>();
 
     if (!seq->load(sqPath)) return false;
 
-    SynthEngine spu;
-    spu.set_data(bd, hd);
-    
-    // Apply seq header
-    for (const auto& [idx, init] : seq->channel_inits) {
-        if (idx >= 16) continue;
-        spu.channels[idx].prog = init.prog_idx;
-        spu.channels[idx].vol = init.vol;
-        spu.channels[idx].pan = init.pan;
-        spu.channels[idx].modulation = init.modulation;
-        spu.channels[idx].breath_rate = init.vibrato;
-        spu.channels[idx].lfo_depth = init.modulation / 127.0f;
+    int rate = options.sample_rate > 0 ? options.sample_rate : 44100;
+    u64 start_sample = options.start_seconds > 0.0 ? (u64)(options.start_seconds * rate) : 0;
+    u64 end_sample = options.end_seconds > 0.0 ? (u64)(options.end_seconds * rate) : UINT64_MAX;
+    if (end_sample <= start_sample) return false;
+
+    // With a fade the last pass runs on into the loop again and is faded out from where it
+    // reached loop_end; anything written after the marker is never reached
+    int loop_count = std::max(1, options.loop_count);
+    u64 fade_samples = options.fade_seconds > 0.0 ? (u64)(options.fade_seconds * rate) : 0;
+    u64 fade_start = UINT64_MAX;
+    if (fade_samples > 0) {
+        Sequencer timing(seq.get(), nullptr);
+        timing.set_sample_rate(rate);
+        timing.set_loop_count(loop_count);
+        for (int n = timing.advance(); n > 0 && !timing.left_loop(); n = timing.advance()) timing.consume(n);
+        fade_start = timing.left_loop() ? timing.loop_exit_position() : timing.position();
+        end_sample = std::min(end_sample, fade_start + fade_samples);
+        if (end_sample <= start_sample) return false;
+        loop_count = 0;
     }
+    bool tail = (end_sample == UINT64_MAX);
 
-    std::vector<float> mix_l, mix_r;
-    float current_bpm = seq->tempo_bpm <= 0 ? 120.0f : seq->tempo_bpm;
-    size_t event_idx = 0;
-    size_t total_events = seq->events.size();
-
-    while (event_idx < seq->events.size()) {
+    int threads = options.threads > 0 ? options.threads : (int)std::max(1u, std::thread::hardware_concurrency());
 
-        if (progressCallback && (event_idx % 100 == 0)) {
-            progressCallback((int)event_idx, (int)total_events);
-        }
+    // The extension picks the container
+    std::unique_ptr<AudioSink> sink;
+    if (HasExtension(wavPath, ".flac")) sink = std::make_unique<FlacSink>(options.format, threads);
+    else sink = std::make_unique<WavSink>(options.format);
+    if (!sink->open(wavPath, rate)) return false;
 
-        const auto& ev = seq->events[event_idx];
-        if (ev.type == "loop_end") break;
-
-        float sec_per_tick = (60.0f / current_bpm) / seq->ticks_per_quarter;
-        float samples_per_tick = sec_per_tick * 44100.0f;
-
-        if (ev.delta > 0) {
-            int num_samples = (int)(ev.delta * samples_per_tick);
-            if (num_samples > 0) {
-                std::vector<float> dl, dr, wl, wr;
-                spu.render_block(num_samples, dl, dr, wl, wr, samples_per_tick);
-
-                if (useReverb) {
-                    std::vector<float> rl, rr;
-                    spu.reverb.process(wl, wr, rl, rr);
-                    for(size_t i=0; i<dl.size(); i++) {
-                        mix_l.push_back(dl[i] + rl[i] * 0.5f);
-                        mix_r.push_back(dr[i] + rr[i] * 0.5f);
-                    }
-                } else {
-                    mix_l.insert(mix_l.end(), dl.begin(), dl.end());
-                    mix_r.insert(mix_r.end(), dr.begin(), dr.end());
-                }
+    ReverbEngine reverb;
+    reverb.init_studio_large();
+    reverb.scale_to_rate(rate);
+
+    // Reverb, master mix and fade, run on the pipeline's second stage
+    std::vector<float> rl, rr;
+    u64 out_pos = start_sample;
+    auto master = [&](PipelineBlock& block) {
+        size_t count = block.dl.size();
+        if (useReverb) {
+            reverb.process(block.wl, block.wr, rl, rr);
+            for(size_t i=0; i<count; i++) {
+                block.dl[i] += rl[i] * 0.5f;
+                block.dr[i] += rr[i] * 0.5f;
             }
         }
-
-        if (ev.type == "note") {
-            if (ev.cmd == 0x90 && ev.vel > 0) spu.note_on(ev.ch, ev.note, ev.vel);
-            else spu.note_off(ev.ch, ev.note);
+        if (out_pos + count > fade_start) {
+            for (size_t i = 0; i < count; i++) {
+                u64 pos = out_pos + i;
+                if (pos < fade_start) continue;
+                float gain = 1.0f - (float)(pos - fade_start) / (float)fade_samples;
+                block.dl[i] *= gain;
+                block.dr[i] *= gain;
+            }
         }
-        else if (ev.type == "prog") spu.program_change(ev.ch, ev.val);
-        else if (ev.type == "pitch") spu.pitch_bend(ev.ch, ev.val);
-        else if (ev.type == "cc") spu.control_change(ev.ch, ev.cc_val, ev.val);
-        else if (ev.type == "tempo") current_bpm = (float)ev.val;
+        out_pos += count;
+    };
 
-        event_idx++;
+    // Decode only the samples the sequence can reach, up front, so no engine decodes mid-render.
+    // A bank cache already has every sample decoded.
+    SampleBank samples;
+    if (options.bank_cache && options.bank_cache->is_open()) samples.load(*options.bank_cache, hd);
+    else samples.load(hd, bd, SequenceWorkingSet(seq.get(), hd), threads);
+    EnvelopeCache envelopes;
+    float cull = options.cull_db < 0.0 ? (float)std::pow(10.0, options.cull_db / 20.0) : 0.0f;
+    EngineSetup setup{hd, bd, &samples, &envelopes, options.interpolation, options.pan_law, rate, cull};
+
+    auto render_start = std::chrono::steady_clock::now();
+    RenderPipeline pipeline(master, sink.get());
+    BlockSink mix = [&pipeline](const float* dl, const float* dr, const float* wl, const float* wr, size_t count) {
+        pipeline.push(dl, dr, wl, wr, count);
+    };
+    VoiceCounts counts;
+    ProgressReporter progress{progressCallback};
+    u64 mismatches = 0;
+    bool rendered = false;
+    if (start_sample == 0 && threads > 1) {
+        rendered = RenderParallel(seq.get(), setup, threads, loop_count, end_sample, tail, mix, progress, counts, options.verify_parallel ? &mismatches : nullptr);
     }
 
-    if (progressCallback) progressCallback((int)total_events, (int)total_events);
-
-    int tail_samples = 44100 * 2;
-    std::vector<float> dl, dr, wl, wr;
-    spu.render_block(tail_samples, dl, dr, wl, wr, 44100.0f);
-
-    if(useReverb) {
-        std::vector<float> rl, rr;
-        spu.reverb.process(wl, wr, rl, rr);
-        for(size_t i=0; i<dl.size(); i++) {
-            mix_l.push_back(dl[i] + rl[i] * 0.5f);
-            mix_r.push_back(dr[i] + rr[i] * 0.5f);
-        }
-    } else {
-        mix_l.insert(mix_l.end(), dl.begin(), dl.end());
-        mix_r.insert(mix_r.end(), dr.begin(), dr.end());
+    if (!rendered) {
+        SynthEngine spu;
+        setup.apply(spu);
+        // No silent split points to render between, so spread each block's voices instead.
+        // Their groups don't depend on the thread count, only on there being more than one.
+        spu.set_mix_threads(threads);
+
+        // Applies the seq header
+        Sequencer sequencer(seq.get(), &spu);
+        sequencer.set_sample_rate(rate);
+        sequencer.set_loop_count(loop_count);
+        if (start_sample > 0) sequencer.seek(start_sample);
+
+        // Reported in tenths of a percent of the event data, which is all a streamed sequence knows up front
+        size_t total_bytes = std::max<size_t>(sequencer.bytes_total(), 1);
+        auto onEvent = [&](size_t bytes) { progress.report((int)(std::min(bytes, total_bytes) * 1000 / total_bytes)); };
+
+        // A bounded range is cut exactly, full renders get a release tail
+        RenderUntil(spu, sequencer, end_sample, tail, mix, onEvent);
+        counts.add(spu);
     }
-
-    std::ofstream f(wavPath, std::ios::binary);
-    if (!f.is_open()) return false;
-
-    WavHeader h;
-    h.data_size = (u32)mix_l.size() * 4;
-    h.overall_size = h.data_size + 36;
-    f.write((char*)&h, sizeof(h));
-
-    std::vector<s16> pcm;
-    pcm.reserve(mix_l.size() * 2);
-
-    for(size_t i=0; i<mix_l.size(); i++) {
-        float l = std::clamp(mix_l[i], -1.0f, 1.0f);
-        float r = std::clamp(mix_r[i], -1.0f, 1.0f);
-
-        pcm.push_back((s16)(l * 32767.0f));
-        pcm.push_back((s16)(r * 32767.0f));
+    progress.report(1000);
+
+    bool written = pipeline.finish();
+
+    if (options.stats) {
+        options.stats->render_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - render_start).count();
+        options.stats->synth_seconds = pipeline.synth_seconds();
+        options.stats->mix_seconds = pipeline.mix_seconds();
+        options.stats->write_seconds = pipeline.write_seconds();
+        options.stats->voice_samples = counts.rendered;
+        options.stats->culled_samples = counts.culled;
+        options.stats->voices_retired = counts.retired;
+        options.stats->parallel_mismatches = mismatches;
+        options.stats->samples_loaded = samples.size();
+        options.stats->sample_bytes = samples.memory_bytes();
+        options.stats->envelope_hits = envelopes.hits();
+        options.stats->envelope_misses = envelopes.misses();
+        options.stats->envelope_curves = envelopes.size();
+        options.stats->envelope_bytes = envelopes.memory_bytes();
     }
 
-    f.write((char*)pcm.data(), pcm.size() * 2);
-    return true;
+    bool closed = sink->close();
+    return written && closed && mismatches == 0;
 }
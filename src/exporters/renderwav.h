@@ -5,7 +5,48 @@
 #include <functional>
 #include "../format/hd.h"
 #include "../format/bd.h"
+#include "../engine/interp.h"
+#include "../engine/gain.h"
+#include "audiosink.h"
 
-bool ExportSequenceToWav(const std::string& sqPath, const std::string& wavPath, HDParser* hd, BDParser* bd, bool useReverb, bool isMidi, std::function<void(int current, int total)> progressCallback = nullptr);
+class BankCache;
+
+// Filled in by a render when RenderOptions::stats is set
+struct RenderStats {
+    double render_seconds = 0.0;    // Synthesis, mixing and writing out, without loading
+    double synth_seconds = 0.0;     // Busy time of each pipeline stage; they overlap, so
+    double mix_seconds = 0.0;       // together they can exceed render_seconds
+    double write_seconds = 0.0;
+    u64 voice_samples = 0;          // Samples produced across all voices
+    u64 culled_samples = 0;         // Voice-samples skipped as inaudible
+    u64 voices_retired = 0;         // Releasing voices stopped once they could no longer be heard
+    u64 parallel_mismatches = 0;    // Samples where a verified parallel render differed from serial
+    size_t samples_loaded = 0;      // Samples decoded up front, or mapped from a bank cache
+    size_t sample_bytes = 0;
+    u64 envelope_hits = 0;          // Key-ons that found their curve cached
+    u64 envelope_misses = 0;
+    size_t envelope_curves = 0;
+    size_t envelope_bytes = 0;
+};
+
+struct RenderOptions {
+    double start_seconds = 0.0; // Fast-forwards to this point before rendering
+    double end_seconds = 0.0;   // Stops rendering here, 0 renders to the end plus a release tail
+    int threads = 1;            // Worker threads, 0 uses every core. Renders split at silent
+                                // points match a serial one exactly; when that isn't possible,
+                                // voices mix in fixed groups, the same for any count above 1.
+    int loop_count = 1;         // Times the looped section plays
+    double fade_seconds = 0.0;  // Fade-out after the last loop, 0 stops at the loop end
+    Interpolation interpolation = Interpolation::Linear;
+    PanLaw pan_law = PanLaw::ConstantPower;
+    int sample_rate = 44100;    // Output rate, everything is rendered directly at it
+    SampleFormat format = SampleFormat::Pcm16;
+    double cull_db = 0.0;       // Voices peaking below this level (e.g. -120) are not mixed, 0 mixes everything
+    const BankCache* bank_cache = nullptr; // Open cache of hd and bd, used instead of decoding
+    bool verify_parallel = false;   // Also renders a split render serially and fails if they differ
+    RenderStats* stats = nullptr;
+};
+
+bool ExportSequenceToWav(const std::string& sqPath, const std::string& wavPath, HDParser* hd, BDParser* bd, bool useReverb, bool isMidi, std::function<void(int current, int total)> progressCallback = nullptr, const RenderOptions& options = RenderOptions());
 
 #endif // RENDERWAV_H
@@ -0,0 +1,199 @@
+#include "seqstats.h"
+#include "../engine/sequencer.h"
+#include "../engine/adsr.h"
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <map>
+
+// Mirrors SynthEngine::note_on through the program's note map: adds the samples a note
+// sounds on prog to offsets, and the voices' ADSR registers to envelopes when given, and
+// returns how many voices it starts
+static int NoteSamples(const HDParser* hd, int prog, int note, std::set<u32>& offsets, std::vector<u32>* envelopes = nullptr) {
+    const Program* p = hd->program(prog);
+    if (!p || p->is_sfx) return 0;
+    const ToneSpan& span = p->tones_for(note);
+    int count = 0;
+    for (int i = span.first; i < span.first + span.count; i++) {
+        const Tone& tone = p->tones[p->note_tones[i]];
+        if (tone.is_noise()) continue;
+        offsets.insert(tone.bd_offset);
+        if (envelopes) envelopes->push_back(((u32)tone.adsr2 << 16) | (u32)tone.adsr1);
+        count++;
+    }
+    return count;
+}
+
+// Samples a voice keeps sounding after key-off. Release only depends on the register and
+// the level it starts from, so tails are cached on both.
+static u64 ReleaseTail(u32 registers, u64 held, std::map<std::pair<u32, s16>, u64>& cache) {
+    HardwareADSR adsr(registers);
+    adsr.KeyOn();
+    adsr.Advance((u32)std::min<u64>(held, UINT32_MAX));
+    if (adsr.phase == HardwareADSR::Phase::Off) return 0;
+    adsr.KeyOff();
+    auto key = std::make_pair(registers, adsr.current_volume);
+    auto it = cache.find(key);
+    if (it != cache.end()) return it->second;
+
+    s16 block[4096];
+    u64 tail = 0;
+    while (adsr.phase != HardwareADSR::Phase::Off) tail += adsr.TickBlock(block, 4096);
+    cache.emplace(key, tail);
+    return tail;
+}
+
+SequenceStats AnalyzeSequence(SeqInterface* seq, const HDParser* hd) {
+    SequenceStats stats;
+    stats.ticks_per_quarter = seq->ticks_per_quarter;
+
+    // Timing comes from a synth-less sequencer so it matches the renderer sample for sample
+    Sequencer timing(seq, nullptr);
+    timing.set_sample_rate(SynthEngine::kSpuRate);
+    for (int n = timing.advance(); n > 0; n = timing.advance()) timing.consume(n);
+    stats.duration_samples = timing.position();
+    stats.duration_seconds = (double)stats.duration_samples / SynthEngine::kSpuRate;
+
+    // The events are walked over the same span: one pass that plays on past loop_end to the
+    // end. The timing pass's tempo map gives each event's sample.
+    const TempoMap& tempo = timing.tempo_map();
+    u64 tick = 0, now = 0;
+
+    struct HeldNote { int note; int voices; bool release_pending; u64 start; std::vector<u32> envelopes; };
+    std::vector<HeldNote> held[16];
+    // Voice counts changing at a sample, for the peak with release tails
+    std::vector<std::pair<u64, int>> changes;
+    std::map<std::pair<u32, s16>, u64> tails;
+    bool sustain[16] = {};
+    int prog[16] = {};
+    int voices = 0;
+
+    for (const auto& [idx, init] : seq->channel_inits) {
+        if (idx < 16) prog[idx] = init.prog_idx;
+    }
+
+    auto release = [&](int ch, auto pred) {
+        auto& list = held[ch];
+        for (size_t i = 0; i < list.size();) {
+            if (pred(list[i])) {
+                const HeldNote& h = list[i];
+                voices -= h.voices;
+                if (h.envelopes.empty()) changes.push_back({now, -h.voices});
+                for (u32 reg : h.envelopes) changes.push_back({now + ReleaseTail(reg, now - h.start, tails), -1});
+                list.erase(list.begin() + i);
+            }
+            else i++;
+        }
+    };
+
+    auto events = seq->events();
+    SQEvent ev;
+    while (events->next(ev)) {
+        stats.total_ticks += ev.delta;
+        tick += ev.delta;
+        now = tempo.sample_at(tick);
+        if (ev.type == "end") break;
+        if (ev.type == "loop_start") stats.has_loop_start = true;
+        if (ev.type == "tempo") { stats.tempo_changes++; continue; }
+        if (ev.ch < 0 || ev.ch >= 16) continue;
+        int ch = ev.ch;
+
+        if (ev.type == "note") {
+            if (ev.cmd == 0x90 && ev.vel > 0) {
+                stats.total_notes++;
+                stats.notes_per_channel[ch]++;
+                stats.programs.insert(prog[ch]);
+                std::vector<u32> envelopes;
+                int n = hd ? NoteSamples(hd, prog[ch], ev.note, stats.bd_offsets, &envelopes) : 1;
+                if (n > 0) {
+                    held[ch].push_back({ev.note, n, false, now, std::move(envelopes)});
+                    changes.push_back({now, n});
+                    voices += n;
+                    stats.peak_held_voices = std::max(stats.peak_held_voices, voices);
+                }
+            } else if (sustain[ch]) {
+                for (auto& h : held[ch]) if (h.note == ev.note) h.release_pending = true;
+            } else {
+                release(ch, [&](const HeldNote& h) { return h.note == ev.note; });
+            }
+        }
+        else if (ev.type == "prog") prog[ch] = ev.val;
+        else if (ev.type == "cc" && ev.cc_val == 64) {
+            sustain[ch] = ev.val >= 64;
+            if (!sustain[ch]) release(ch, [](const HeldNote& h) { return h.release_pending; });
+        }
+    }
+
+    // Voices that finish on a sample stop before ones starting on it
+    std::sort(changes.begin(), changes.end());
+    int sounding = 0;
+    for (const auto& [at, delta] : changes) {
+        sounding += delta;
+        stats.peak_voices = std::max(stats.peak_voices, sounding);
+    }
+    return stats;
+}
+
+std::set<u32> SequenceWorkingSet(SeqInterface* seq, const HDParser* hd) {
+    std::set<int> programs[16];
+    bool notes[16][128] = {};
+    for (const auto& [idx, init] : seq->channel_inits) {
+        if (idx < 16) programs[idx].insert(init.prog_idx);
+    }
+
+    // Every event in the file, the looped section included, is read once
+    auto events = seq->events();
+    SQEvent ev;
+    while (events->next(ev)) {
+        if (ev.type == "end") break;
+        if (ev.ch < 0 || ev.ch >= 16) continue;
+        if (ev.type == "prog") programs[ev.ch].insert(ev.val);
+        else if (ev.type == "note" && ev.cmd == 0x90 && ev.vel > 0 && ev.note >= 0 && ev.note < 128) notes[ev.ch][ev.note] = true;
+    }
+
+    std::set<u32> offsets;
+    for (int ch = 0; ch < 16; ch++) {
+        for (int prog : programs[ch]) {
+            for (int note = 0; note < 128; note++) {
+                if (notes[ch][note]) NoteSamples(hd, prog, note, offsets);
+            }
+        }
+    }
+    return offsets;
+}
+
+static std::string json_escape(const std::string& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') { out += '\\'; out += c; }
+        else if ((unsigned char)c < 0x20) { char buf[8]; snprintf(buf, sizeof(buf), "\\u%04x", c); out += buf; }
+        else out += c;
+    }
+    return out;
+}
+
+std::string SequenceStatsToJson(const SequenceStats& stats, const std::string& name) {
+    std::ostringstream js;
+    js << "{\"file\": \"" << json_escape(name) << "\"";
+    js << ", \"duration_seconds\": " << std::fixed << std::setprecision(3) << stats.duration_seconds;
+    js << ", \"duration_samples\": " << stats.duration_samples;
+    js << ", \"ticks\": " << stats.total_ticks;
+    js << ", \"ticks_per_quarter\": " << stats.ticks_per_quarter;
+    js << ", \"tempo_changes\": " << stats.tempo_changes;
+    js << ", \"loop_start\": " << (stats.has_loop_start ? "true" : "false");
+    js << ", \"notes\": " << stats.total_notes;
+    js << ", \"notes_per_channel\": [";
+    for (int i = 0; i < 16; i++) js << (i ? ", " : "") << stats.notes_per_channel[i];
+    js << "], \"peak_held_voices\": " << stats.peak_held_voices;
+    js << ", \"peak_voices\": " << stats.peak_voices;
+    js << ", \"programs\": [";
+    bool first = true;
+    for (int p : stats.programs) { js << (first ? "" : ", ") << p; first = false; }
+    js << "], \"bd_offsets\": [";
+    first = true;
+    for (u32 off : stats.bd_offsets) { js << (first ? "" : ", ") << off; first = false; }
+    js << "]}";
+    return js.str();
+}
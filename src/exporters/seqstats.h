@@ -0,0 +1,37 @@
+#ifndef SEQSTATS_H
+#define SEQSTATS_H
+
+#include "../common.h"
+#include "../format/sq.h"
+#include "../format/hd.h"
+#include <string>
+#include <set>
+
+struct SequenceStats {
+    u64 duration_samples = 0;   // One pass to the end at the SPU's native rate, past loop_end
+                                // but without the release tail
+    double duration_seconds = 0.0;
+    u64 total_ticks = 0;
+    int ticks_per_quarter = 0;
+    int tempo_changes = 0;
+    bool has_loop_start = false; // Explicit loop start marker, otherwise loops restart the song
+    int total_notes = 0;
+    int notes_per_channel[16] = {};
+    int peak_held_voices = 0;   // Voices of notes held down at once (key or sustain pedal),
+                                // resolved through the HD tone ranges; release tails not counted
+    int peak_voices = 0;        // Voices sounding at once, release tails included. Without BD
+                                // sample lengths, one-shots count until their envelope ends.
+    std::set<int> programs;
+    std::set<u32> bd_offsets;
+};
+
+// Walks the events once without rendering, over the span duration_samples covers. hd may be
+// null, every note then counts as one voice with no release.
+SequenceStats AnalyzeSequence(SeqInterface* seq, const HDParser* hd);
+// BD offsets of every sample the sequence can sound, however many times it loops. A later
+// pass can start with the program a channel ended the loop on, so each channel's notes are
+// resolved against every program the channel ever selects.
+std::set<u32> SequenceWorkingSet(SeqInterface* seq, const HDParser* hd);
+std::string SequenceStatsToJson(const SequenceStats& stats, const std::string& name);
+
+#endif // SEQSTATS_H
@@ -64,6 +64,14 @@ bool Sf2Exporter::exportToSf2(const QString& path, HDParser* hd, BDParser* bd) {
             }
 
             auto addZone = [&](const Tone& t, int forcedPan = -1) {
+                // Instruments get the notes where the engine actually plays the tone, one zone per run of
+                // them, and shadowed tones are skipped. SFX tones are triggered individually, so they keep
+                // their raw range.
+                std::vector<KeyRange> runs;
+                if (prog->is_sfx) runs.push_back({std::min<int>(t.min_note, t.max_note), std::max<int>(t.min_note, t.max_note)});
+                else runs = prog->tone_key_runs((int)(&t - prog->tones.data()));
+                if (runs.empty()) return;
+
                 std::shared_ptr<SFSample> sfSample;
                 bool isLooping = false;
 
@@ -91,52 +99,52 @@ bool Sf2Exporter::exportToSf2(const QString& path, HDParser* hd, BDParser* bd) {
                     isLooping = res.looping;
                 }
 
-                // 2. Create Zone
-                SFInstrumentZone zone(sfSample);
+                // 2. Create a zone per run of keys
+                for (const KeyRange& keys : runs) {
+                    SFInstrumentZone zone(sfSample);
 
-                // Loop Mode
-                zone.SetGenerator(SFGeneratorItem(SFGenerator::kSampleModes,
-                                                  uint16_t(isLooping ? SampleMode::kLoopContinuously : SampleMode::kNoLoop)));
+                    // Loop Mode
+                    zone.SetGenerator(SFGeneratorItem(SFGenerator::kSampleModes,
+                                                      uint16_t(isLooping ? SampleMode::kLoopContinuously : SampleMode::kNoLoop)));
 
-                // Key Range
-                uint8_t kMin = t.min_note; uint8_t kMax = t.max_note;
-                if (kMin > kMax) std::swap(kMin, kMax);
-                zone.SetGenerator(SFGeneratorItem(SFGenerator::kKeyRange, RangesType(kMin, kMax)));
+                    // Key Range
+                    zone.SetGenerator(SFGeneratorItem(SFGenerator::kKeyRange, RangesType((uint8_t)keys.lo, (uint8_t)keys.hi)));
 
-                // Pan (Use forcedPan if provided, else calculate)
-                int panVal;
-                if (forcedPan != -1) {
-                    panVal = forcedPan;
-                } else {
-                    int p = ((int)t.pan + (int)prog->master_pan - 64);
-                    panVal = (Util::clamp_pan(p) - 64) * 10;
-                }
-                panVal = std::clamp(panVal, -500, 500);
-                zone.SetGenerator(SFGeneratorItem(SFGenerator::kPan, panVal));
+                    // Pan (Use forcedPan if provided, else calculate)
+                    int panVal;
+                    if (forcedPan != -1) {
+                        panVal = forcedPan;
+                    } else {
+                        int p = ((int)t.pan + (int)prog->master_pan - 64);
+                        panVal = (Util::clamp_pan(p) - 64) * 10;
+                    }
+                    panVal = std::clamp(panVal, -500, 500);
+                    zone.SetGenerator(SFGeneratorItem(SFGenerator::kPan, panVal));
 
-                // Reverb
-                if (t.is_reverb()) {
-                    zone.SetGenerator(SFGeneratorItem(SFGenerator::kReverbEffectsSend, 500));
-                }
+                    // Reverb
+                    if (t.is_reverb()) {
+                        zone.SetGenerator(SFGeneratorItem(SFGenerator::kReverbEffectsSend, 500));
+                    }
 
-                // ADSR (Hardware Simulation)
-                u32 reg = ((u32)t.adsr2 << 16) | t.adsr1;
+                    // ADSR (Hardware Simulation)
+                    u32 reg = ((u32)t.adsr2 << 16) | t.adsr1;
 
-                int16_t att = HardwareADSR::calculate_timecents(reg, HardwareADSR::Phase::Attack);
-                zone.SetGenerator(SFGeneratorItem(SFGenerator::kAttackVolEnv, att));
+                    int16_t att = HardwareADSR::calculate_timecents(reg, HardwareADSR::Phase::Attack);
+                    zone.SetGenerator(SFGeneratorItem(SFGenerator::kAttackVolEnv, att));
 
-                int16_t dec = HardwareADSR::calculate_timecents(reg, HardwareADSR::Phase::Decay);
-                zone.SetGenerator(SFGeneratorItem(SFGenerator::kDecayVolEnv, dec));
+                    int16_t dec = HardwareADSR::calculate_timecents(reg, HardwareADSR::Phase::Decay);
+                    zone.SetGenerator(SFGeneratorItem(SFGenerator::kDecayVolEnv, dec));
 
-                int16_t rel = HardwareADSR::calculate_timecents(reg, HardwareADSR::Phase::Release);
-                zone.SetGenerator(SFGeneratorItem(SFGenerator::kReleaseVolEnv, rel));
+                    int16_t rel = HardwareADSR::calculate_timecents(reg, HardwareADSR::Phase::Release);
+                    zone.SetGenerator(SFGeneratorItem(SFGenerator::kReleaseVolEnv, rel));
 
-                // Sustain Level (Convert 0-15 to attenuation)
-                u32 sl = t.adsr1 & 0x0F;
-                uint16_t sf_sl = (15 - sl) * (1000 / 15);
-                zone.SetGenerator(SFGeneratorItem(SFGenerator::kSustainVolEnv, sf_sl));
+                    // Sustain Level (Convert 0-15 to attenuation)
+                    u32 sl = t.adsr1 & 0x0F;
+                    uint16_t sf_sl = (15 - sl) * (1000 / 15);
+                    zone.SetGenerator(SFGeneratorItem(SFGenerator::kSustainVolEnv, sf_sl));
 
-                sfInst->AddZone(std::move(zone));
+                    sfInst->AddZone(std::move(zone));
+                }
             };
 
 
@@ -1,9 +1,11 @@
 #include "hd.h"
 #include <fstream>
 #include <cstring>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
-void HDParser::clear() { programs.clear(); breath_scripts.clear(); data.clear(); }
+void HDParser::clear() { bank.reset(); programs.clear(); breath_scripts.clear(); breath_depths.clear(); data.clear(); }
 
 bool HDParser::load(const std::string& filename) {
     clear();
@@ -18,32 +20,51 @@ bool HDParser::load(const std::string& filename) {
 void HDParser::parse() {
     u32 prog_offset = Util::readU32(data, 0x10);
     u32 breath_offset = Util::readU32(data, 0x18);
-    if (prog_offset < data.size()) parse_programs(prog_offset);
+    auto flat = std::make_shared<HDBank>();
+    if (prog_offset < data.size()) parse_programs(prog_offset, *flat);
     if (breath_offset < data.size()) parse_breath_waves(breath_offset);
+
+    set_bank(flat);
+}
+
+void HDParser::set_bank(std::shared_ptr<HDBank> flat) {
+    // The adapters share ownership of the bank, so they stay valid after a reload
+    programs.clear();
+    if (flat) {
+        for (Program& prog : flat->programs) programs.push_back(prog.id >= 0 ? std::shared_ptr<Program>(flat, &prog) : nullptr);
+    }
+    bank = flat;
 }
 
-void HDParser::parse_programs(u32 base_offset) {
+void HDParser::parse_programs(u32 base_offset, HDBank& out) {
     u16 count = Util::readU16(data, base_offset) + 1;
     u32 ptr_table = base_offset + 2;
+    // Pool offsets per program; the views are pointed at the pools once they stop growing
+    struct Extent { size_t tone_first, tone_count, note_first, note_count; };
+    std::vector<Extent> extents;
+    out.programs.reserve(count);
+    extents.reserve(count);
     for (int i = 0; i < count; i++) {
         if (ptr_table + (i * 2) + 2 > data.size()) break;
         u16 rel_offset = Util::readU16(data, ptr_table + (i * 2));
-        if (rel_offset == 0xFFFF) { programs.push_back(nullptr); continue; }
+        out.programs.emplace_back();
+        extents.push_back({out.tones.size(), 0, out.note_tones.size(), 0});
+        if (rel_offset == 0xFFFF) continue;
 
         u32 abs_offset = base_offset + rel_offset;
-        auto prog = std::make_shared<Program>();
-        prog->id = i;
-        prog->type = data[abs_offset];
-        prog->master_vol = data[abs_offset + 1];
-        prog->master_pan = data[abs_offset + 2];
-        prog->pitch_mult = data[abs_offset + 4];
-        prog->breath_idx = data[abs_offset + 5];
+        Program& prog = out.programs.back();
+        prog.id = i;
+        prog.type = data[abs_offset];
+        prog.master_vol = data[abs_offset + 1];
+        prog.master_pan = data[abs_offset + 2];
+        prog.pitch_mult = data[abs_offset + 4];
+        prog.breath_idx = data[abs_offset + 5];
 
-        prog->is_sfx = (prog->type == 0xFF);
-        if (prog->is_sfx) prog->is_layered = false;
-        else prog->is_layered = (prog->type & 0x80) != 0;
+        prog.is_sfx = (prog.type == 0xFF);
+        if (prog.is_sfx) prog.is_layered = false;
+        else prog.is_layered = (prog.type & 0x80) != 0;
 
-        int tone_count = prog->is_sfx ? data[abs_offset + 7] : (prog->type & 0x7F) + 1;
+        int tone_count = prog.is_sfx ? data[abs_offset + 7] : (prog.type & 0x7F) + 1;
         u32 current_tone_offset = abs_offset + 8;
 
         for (int t = 0; t < tone_count; t++) {
@@ -58,10 +79,44 @@ void HDParser::parse_programs(u32 base_offset) {
             tone.pitch_mult = data[current_tone_offset + 13]; tone.breath_idx = data[current_tone_offset + 14];
             tone.flags = data[current_tone_offset + 15];
             tone.adsr2 = raw_adsr2 ^ (u16)data[current_tone_offset + 10];
-            prog->tones.push_back(tone);
+            out.tones.push_back(tone);
             current_tone_offset += 16;
         }
-        programs.push_back(prog);
+        Extent& ext = extents.back();
+        ext.tone_count = out.tones.size() - ext.tone_first;
+        build_note_map(prog, out.tones.data() + ext.tone_first, ext.tone_count, out.note_tones);
+        ext.note_count = out.note_tones.size() - ext.note_first;
+    }
+    for (size_t i = 0; i < out.programs.size(); i++) {
+        out.programs[i].tones = { out.tones.data() + extents[i].tone_first, extents[i].tone_count };
+        out.programs[i].note_tones = { out.note_tones.data() + extents[i].note_first, extents[i].note_count };
+    }
+}
+
+// Layered programs sound every tone whose range covers the note, the rest only the first one.
+// Neighbouring notes with the same tones share one span. Spans count from where this
+// program's entries start in the shared note_tones.
+void HDParser::build_note_map(Program& prog, const Tone* tones, size_t tone_count, std::vector<u16>& note_tones) {
+    size_t base = note_tones.size();
+    std::vector<u16> current;
+    for (int note = 0; note < 128; note++) {
+        current.clear();
+        for (size_t t = 0; t < tone_count; t++) {
+            const Tone& tone = tones[t];
+            if (note < tone.min_note || note > tone.max_note) continue;
+            current.push_back((u16)t);
+            if (!prog.is_layered) break;
+        }
+        ToneSpan span;
+        if (note > 0 && prog.note_map[note - 1].count == current.size() &&
+            std::equal(current.begin(), current.end(), note_tones.begin() + base + prog.note_map[note - 1].first)) {
+            span = prog.note_map[note - 1];
+        } else if (!current.empty()) {
+            span.first = (u16)(note_tones.size() - base);
+            span.count = (u16)current.size();
+            note_tones.insert(note_tones.end(), current.begin(), current.end());
+        }
+        prog.note_map[note] = span;
     }
 }
 
@@ -79,6 +134,21 @@ void HDParser::parse_breath_waves(u32 base_offset) {
         std::memcpy(script.data(), data.data() + start, end - start);
         breath_scripts.push_back(script);
     }
+    for (const auto& script : breath_scripts) breath_depths.push_back(build_breath_depth(script));
+}
+
+std::vector<u8> HDParser::build_breath_depth(const std::vector<u8>& script) {
+    // Three-point moving average around the loop
+    std::vector<u8> curve = script;
+    size_t n = script.size();
+    if (n > 3) {
+        for (size_t i = 0; i < n; ++i) {
+            int sum = script[(i + n - 1) % n] + script[i] + script[(i + 1) % n];
+            curve[i] = (u8)std::clamp(sum / 3, 0, 255);
+        }
+    }
+    if (curve.size() >= 2) curve.back() = curve.front();
+    return curve;
 }
 
 void HDParser::print_debug_info() const { /* ... */ }
@@ -6,20 +6,44 @@
 #include <memory>
 #include <string>
 
+// A parsed bank in flat arrays: one record per program slot, with every program's tones and
+// note lists stored back to back in shared pools
+struct HDBank {
+    std::vector<Program> programs;  // Indexed by program number, unused slots have id -1
+    std::vector<Tone> tones;
+    std::vector<u16> note_tones;
+};
+
 class HDParser {
 public:
+    std::shared_ptr<const HDBank> bank;
+    // Compatibility view of bank: pointers into its records that keep it alive, null for unused slots
     std::vector<std::shared_ptr<Program>> programs;
     std::vector<std::vector<u8>> breath_scripts;
+    // Vibrato depth curves made from breath_scripts at load: smoothed, with the ends matched so
+    // the loop doesn't click. Voices point into these, so they stay fixed until the next load.
+    std::vector<std::vector<u8>> breath_depths;
 
     bool load(const std::string& filename);
+    // Installs a bank and rebuilds the programs view over it
+    void set_bank(std::shared_ptr<HDBank> flat);
+    const std::vector<u8>& getData() const { return data; }
+    // Record for a program number, null if the slot is unused
+    const Program* program(int idx) const {
+        if (!bank || idx < 0 || idx >= (int)bank->programs.size()) return nullptr;
+        const Program& p = bank->programs[idx];
+        return p.id >= 0 ? &p : nullptr;
+    }
     void clear();
     void print_debug_info() const;
 
 private:
     std::vector<u8> data;
     void parse();
-    void parse_programs(u32 base_offset);
+    void parse_programs(u32 base_offset, HDBank& out);
     void parse_breath_waves(u32 base_offset);
+    static void build_note_map(Program& prog, const Tone* tones, size_t tone_count, std::vector<u16>& note_tones);
+    static std::vector<u8> build_breath_depth(const std::vector<u8>& script);
 };
 
 #endif // HD_H
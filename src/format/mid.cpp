@@ -1,247 +1,309 @@
 #include "mid.h"
 #include <fstream>
+#include <cstdio>
 #include <cstring>
 #include <algorithm>
+#include <cctype>
 
-static void write_varlen_fp(FILE* fp, uint32_t value) {
-    uint32_t buffer = value & 0x7F;
-    while ((value >>= 7)) {
-        buffer <<= 8;
-        buffer |= ((value & 0x7F) | 0x80);
+// One MTrk chunk assembled in memory, with its own clock and running status
+struct MidiTrackWriter {
+    std::vector<u8> bytes;
+    u32 time = 0;
+    u8 running = 0;
+
+    void varlen(u32 value) {
+        u8 buf[5]; int n = 0;
+        do { buf[n++] = value & 0x7F; value >>= 7; } while (value);
+        while (n > 1) bytes.push_back(buf[--n] | 0x80);
+        bytes.push_back(buf[0]);
+    }
+    void delta(u32 abs_time) { varlen(abs_time - time); time = abs_time; }
+
+    void channel(u32 abs_time, u8 status, u8 d0) { channel(abs_time, status, d0, 0, 1); }
+    void channel(u32 abs_time, u8 status, u8 d0, u8 d1, int len = 2) {
+        delta(abs_time);
+        if (status != running) { bytes.push_back(status); running = status; }
+        bytes.push_back(d0 & 0x7F);
+        if (len > 1) bytes.push_back(d1 & 0x7F);
+    }
+    void meta(u32 abs_time, u8 type, const u8* data, size_t len) {
+        delta(abs_time);
+        bytes.push_back(0xFF); bytes.push_back(type);
+        varlen((u32)len);
+        bytes.insert(bytes.end(), data, data + len);
+        running = 0;
     }
-    while (true) {
-        fputc(buffer & 0xFF, fp);
-        if (buffer & 0x80) buffer >>= 8;
-        else break;
+    void text(u32 abs_time, u8 type, const char* str) { meta(abs_time, type, (const u8*)str, strlen(str)); }
+    void tempo(u32 abs_time, int mpqn) {
+        u8 t[3] = { (u8)(mpqn >> 16), (u8)(mpqn >> 8), (u8)mpqn };
+        meta(abs_time, 0x51, t, 3);
     }
+};
+
+static void put_be(std::vector<u8>& out, u32 value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) out.push_back((u8)(value >> (i * 8)));
 }
 
+// Writes a format 1 file: a conductor track with tempo, time signature and loop markers, then
+// one track per channel that has events, starting with the SQ header's program, volume and pan.
+// The file is built in memory and written in one go.
 bool SaveSQToMidi(const std::vector<u8>& data, const std::string& filename) {
     if (data.size() < 0x110) return false;
-    
-    FILE* fp = fopen(filename.c_str(), "wb");
-    if (!fp) return false;
-    
-    // Write MThd header
-    fputc(0x4D, fp); fputc(0x54, fp); fputc(0x68, fp); fputc(0x64, fp); // "MThd"
-    fputc(0x00, fp); fputc(0x00, fp); fputc(0x00, fp); fputc(0x06, fp); // Header size = 6
-    fputc(0x00, fp); fputc(0x00, fp); // Format 0
-    fputc(0x00, fp); fputc(0x01, fp); // 1 track
-    fputc(data[3], fp); fputc(data[2], fp); // Delta time (division)
-    
-    // Write MTrk header
-    fputc(0x4D, fp); fputc(0x54, fp); fputc(0x72, fp); fputc(0x6B, fp); // "MTrk"
-    
-    // Track size placeholder (will fill in later)
-    long trackSizePos = ftell(fp);
-    fputc(0x00, fp); fputc(0x00, fp); fputc(0x00, fp); fputc(0x00, fp);
-    
-    // Initial tempo event
-    fputc(0x04, fp);
-    fputc(0xFF, fp);
-    fputc(0x51, fp);
-    fputc(0x03, fp);
+    auto byte_at = [&](size_t pos) -> u8 { return pos < data.size() ? data[pos] : 0; };
+
+    MidiTrackWriter conductor;
+    MidiTrackWriter channels[16];
+    bool used[16] = {};
+
     u16 tempo = Util::readU16(data, 4);
-    int val = tempo > 0 ? (60000000 / tempo) : 500000;
-    fputc((val >> 16) & 0xFF, fp);
-    fputc((val >> 8) & 0xFF, fp);
-    fputc(val & 0xFF, fp);
-    
-    // Time signature
-    fputc(0x08, fp);
-    fputc(0xFF, fp);
-    fputc(0x58, fp);
-    fputc(0x04, fp);
-    fputc(0x04, fp);
-    fputc(0x02, fp);
-    fputc(0x18, fp);
-    fputc(0x08, fp);
-
-    // Write data, SQ format is almost identical to MIDI, main difference is pitch bend (1 byte vs 2 bytes)
-    fputc(0x00, fp);
-    
+    conductor.tempo(0, tempo > 0 ? (60000000 / tempo) : 500000);
+    const u8 time_sig[4] = { 0x04, 0x02, 0x18, 0x08 };
+    conductor.meta(0, 0x58, time_sig, 4);
+
+    for (int ch = 0; ch < 16; ch++) {
+        size_t init = 0x10 + ch * 16;
+        channels[ch].channel(0, 0xC0 | ch, data[init + 2]);
+        channels[ch].channel(0, 0xB0 | ch, 7, data[init + 3]);
+        channels[ch].channel(0, 0xB0 | ch, 10, data[init + 4]);
+    }
+
+    // SQ is almost MIDI, the differences are a 1 byte pitch bend and a 1 byte bpm tempo
     size_t cursor = 0x110;
+    u32 abs_time = 0;
     u8 runningStatus = 0;
-    
     while (cursor < data.size()) {
-        // Delta
-        while (cursor < data.size()) {
-            u8 byte = data[cursor++];
-            fputc(byte, fp);
-            if (!(byte & 0x80)) break;
-        }
-        
+        auto res = Util::read_varlen(data, cursor); abs_time += res.first; cursor = res.second;
         if (cursor >= data.size()) break;
-        
-        u8 currentByte = data[cursor];
-        bool useRunningStatus = false;
-        u8 statusByte;
-        
-        if (currentByte >= 0x80 && currentByte <= 0xEF) {
-            statusByte = currentByte;
-            runningStatus = statusByte;
-            cursor++;
-            fputc(statusByte, fp);
-        } else if (currentByte >= 0xF0) {
-            statusByte = currentByte;
-            runningStatus = 0;
+
+        u8 statusByte = data[cursor];
+        if (statusByte >= 0x80) {
             cursor++;
-            fputc(statusByte, fp);
-        } else {
-            statusByte = runningStatus;
-            useRunningStatus = true;
-        }
-        
+            runningStatus = statusByte < 0xF0 ? statusByte : 0;
+        } else statusByte = runningStatus;
+
         u8 cmd = statusByte & 0xF0;
+        int ch = statusByte & 0x0F;
+        if (cmd >= 0x80 && cmd <= 0xE0) used[ch] = true;
 
         switch (cmd) {
             case 0x80:  // Note Off
             case 0x90:  // Note On
             case 0xA0:  // Aftertouch
-            case 0xB0:  // Control Change
-                // 2 data bytes
-                fputc(data[cursor++], fp);
-                fputc(data[cursor++], fp);
+                channels[ch].channel(abs_time, statusByte, byte_at(cursor), byte_at(cursor + 1));
+                cursor += 2;
+                break;
+
+            case 0xB0: { // Control Change, NRPN 20/30 also mark the loop
+                u8 cc = byte_at(cursor), val = byte_at(cursor + 1);
+                cursor += 2;
+                channels[ch].channel(abs_time, statusByte, cc, val);
+                if (cc == 99 && val == 20) conductor.text(abs_time, 0x06, "loopStart");
+                else if (cc == 99 && val == 30) conductor.text(abs_time, 0x06, "loopEnd");
                 break;
-                
+            }
+
             case 0xC0:  // Program Change
             case 0xD0:  // Channel Pressure
-                // 1 data byte
-                fputc(data[cursor++], fp);
+                channels[ch].channel(abs_time, statusByte, byte_at(cursor++));
                 break;
-                
+
             case 0xE0: { // Pitch Bend - SQ uses 1 byte (0-127, center=64), MIDI needs 2 bytes (14-bit, center=8192)
-                u8 sqValue = data[cursor++];
-                int midiValue = (sqValue * 16383) / 127;
-                u8 lsb = midiValue & 0x7F;
-                u8 msb = (midiValue >> 7) & 0x7F;
-                fputc(lsb, fp);
-                fputc(msb, fp);
+                int midiValue = (byte_at(cursor++) * 16383) / 127;
+                channels[ch].channel(abs_time, statusByte, midiValue & 0x7F, (midiValue >> 7) & 0x7F);
                 break;
             }
-                
+
             case 0xF0: { // System/Meta
                 if (statusByte == 0xFF) {
-                    // Meta event
-                    u8 metaType = data[cursor++];
-                    fputc(metaType, fp);
-                    
-                    if (metaType == 0x2F) {
-                        // End of track
-                        u8 len = data[cursor++];
-                        fputc(len, fp);
-                        goto end_track;
-                    } else if (metaType == 0x51) {
+                    u8 metaType = byte_at(cursor++);
+                    u8 len = byte_at(cursor++);
+                    len = (u8)std::min<size_t>(len, data.size() - std::min(cursor, data.size()));
+                    if (metaType == 0x2F) goto end_track;
+                    if (metaType == 0x51 && len == 1) {
                         // Tempo - convert from BPM to microseconds per quarter
-                        u8 len = data[cursor++];
-                        fputc(0x03, fp);  // Always 3 bytes for tempo
-                        if (len == 1 && cursor < data.size()) {
-                            u8 bpm = data[cursor++];
-                            int tempoval = bpm > 0 ? (60000000 / bpm) : 500000;
-                            fputc((tempoval >> 16) & 0xFF, fp);
-                            fputc((tempoval >> 8) & 0xFF, fp);
-                            fputc(tempoval & 0xFF, fp);
-                        } else {
-                            // Already in correct format, copy as-is
-                            for (int i = 0; i < len && cursor < data.size(); i++) {
-                                fputc(data[cursor++], fp);
-                            }
-                        }
+                        u8 bpm = data[cursor];
+                        conductor.tempo(abs_time, bpm > 0 ? (60000000 / bpm) : 500000);
                     } else {
-                        // Other meta events
-                        u8 len = data[cursor++];
-                        fputc(len, fp);
-                        for (int i = 0; i < len && cursor < data.size(); i++) {
-                            fputc(data[cursor++], fp);
-                        }
+                        conductor.meta(abs_time, metaType, data.data() + cursor, len);
                     }
+                    cursor += len;
                 } else if (statusByte == 0xF0 || statusByte == 0xF7) {
                     // SysEx - copy length and data
-                    auto res = Util::read_varlen(data, cursor);
-                    int len = res.first;
-                    cursor = res.second;
-                    write_varlen_fp(fp, len);
-                    for (int i = 0; i < len && cursor < data.size(); i++) {
-                        fputc(data[cursor++], fp);
-                    }
+                    auto sx = Util::read_varlen(data, cursor);
+                    size_t len = std::min<size_t>((size_t)sx.first, data.size() - std::min(sx.second, data.size()));
+                    cursor = sx.second;
+                    conductor.delta(abs_time);
+                    conductor.bytes.push_back(statusByte);
+                    conductor.varlen((u32)len);
+                    conductor.bytes.insert(conductor.bytes.end(), data.begin() + cursor, data.begin() + cursor + len);
+                    conductor.running = 0;
+                    cursor += len;
                 }
                 break;
             }
-                
+
             default:
                 break;
         }
     }
-    
+
 end_track:
-    // write track size
-    long endPos = ftell(fp);
-    u32 trackSize = endPos - trackSizePos - 4;
-    
-    fseek(fp, trackSizePos, SEEK_SET);
-    fputc((trackSize >> 24) & 0xFF, fp);
-    fputc((trackSize >> 16) & 0xFF, fp);
-    fputc((trackSize >> 8) & 0xFF, fp);
-    fputc(trackSize & 0xFF, fp);
-    
-    fclose(fp);
-    return true;
+    std::vector<MidiTrackWriter*> tracks = { &conductor };
+    for (int ch = 0; ch < 16; ch++) if (used[ch]) tracks.push_back(&channels[ch]);
+
+    std::vector<u8> out;
+    size_t total = 14;
+    for (auto* trk : tracks) total += 8 + trk->bytes.size() + 8;
+    out.reserve(total);
+
+    const char mthd[] = "MThd";
+    out.insert(out.end(), mthd, mthd + 4);
+    put_be(out, 6, 4);
+    put_be(out, 1, 2);  // Format 1
+    put_be(out, (u32)tracks.size(), 2);
+    out.push_back(data[3]); out.push_back(data[2]); // Division
+    for (auto* trk : tracks) {
+        // Every track ends together with the sequence
+        trk->meta(abs_time, 0x2F, nullptr, 0);
+        const char mtrk[] = "MTrk";
+        out.insert(out.end(), mtrk, mtrk + 4);
+        put_be(out, (u32)trk->bytes.size(), 4);
+        out.insert(out.end(), trk->bytes.begin(), trk->bytes.end());
+    }
+
+    FILE* fp = fopen(filename.c_str(), "wb");
+    if (!fp) return false;
+    bool ok = fwrite(out.data(), 1, out.size(), fp) == out.size();
+    return fclose(fp) == 0 && ok;
+}
+
+static bool is_loop_marker(const std::vector<u8>& data, size_t cursor, size_t len, const char* name) {
+    std::string text;
+    for (size_t i = 0; i < len && cursor + i < data.size(); i++) {
+        char c = (char)data[cursor + i];
+        if (c == ' ' || c == '_') continue;
+        text += (char)std::tolower((unsigned char)c);
+    }
+    return text == name;
 }
 
-struct AbsEvent {
-    u32 abs_time; SQEvent ev;
-    bool operator<(const AbsEvent& o) const { return abs_time < o.abs_time; }
+// Decodes every track in place and merges them through a heap keyed on (time, track), which
+// keeps the order a stable sort of all events by time would give
+class MidiEventCursor : public EventCursor {
+public:
+    explicit MidiEventCursor(const std::vector<u8>& data);
+    bool next(SQEvent& ev) override;
+    std::unique_ptr<EventCursor> clone() const override { return std::make_unique<MidiEventCursor>(*this); }
+    size_t bytes_read() const override { return m_read; }
+    size_t bytes_total() const override { return m_data.size(); }
+
+private:
+    struct Track {
+        size_t cursor, end;
+        u32 time = 0;
+        u8 running = 0;
+        SQEvent ev{};   // Decoded but not yet returned
+    };
+
+    bool decode(Track& trk);
+    bool later(int a, int b) const {
+        const Track& x = m_tracks[a]; const Track& y = m_tracks[b];
+        return x.time != y.time ? x.time > y.time : a > b;
+    }
+
+    const std::vector<u8>& m_data;
+    std::vector<Track> m_tracks;
+    std::vector<int> m_heap;    // Tracks holding an event, earliest on top
+    u32 m_time = 0;
+    size_t m_read = 14;
+    bool m_has_loop_end = false;
+    bool m_done = false;
 };
 
+MidiEventCursor::MidiEventCursor(const std::vector<u8>& data) : m_data(data) {
+    u16 num_trks_local = Util::readU16BE(data, 10);
+    size_t cursor = 14;
+    for(int t=0; t<num_trks_local; t++) {
+        if(cursor+8 > data.size()) break; if(std::memcmp(data.data()+cursor, "MTrk", 4)!=0) break;
+        u32 len = Util::readU32BE(data, cursor+4); cursor += 8;
+        Track trk; trk.cursor = cursor; trk.end = cursor + len;
+        m_tracks.push_back(trk);
+        cursor = trk.end;
+    }
+    auto heap_order = [this](int a, int b) { return later(a, b); };
+    for(int t=0; t<(int)m_tracks.size(); t++) {
+        if(decode(m_tracks[t])) { m_heap.push_back(t); std::push_heap(m_heap.begin(), m_heap.end(), heap_order); }
+    }
+}
+
+// Reads up to the track's next event
+bool MidiEventCursor::decode(Track& trk) {
+    const auto& data = m_data; size_t& cursor = trk.cursor; size_t start = cursor;
+    bool found = false;
+    while(!found && cursor < trk.end && cursor < data.size()) {
+        auto res = Util::read_varlen(data, cursor); trk.time += res.first; cursor = res.second; if(cursor>=data.size()) break;
+        u8 st = data[cursor]; if(st >= 0x80) { cursor++; if(st < 0xF0) trk.running = st; } else st = trk.running;
+        SQEvent e{};
+        if(st == 0xFF) {
+            u8 type = data[cursor++]; auto lenRes = Util::read_varlen(data, cursor); size_t mlen = lenRes.first; cursor = lenRes.second;
+            if(type == 0x51 && mlen==3) {
+                u32 mpqn = (data[cursor]<<16)|(data[cursor+1]<<8)|data[cursor+2];
+                e.type="tempo"; e.val = (int)(60000000.0/mpqn); e.cc_val = (int)mpqn; found = true;
+            } else if(type == 0x01 || type == 0x06) {
+                // Text/marker loop points, as used by most game rips
+                if(is_loop_marker(data, cursor, mlen, "loopstart")) { e.type="loop_start"; found = true; }
+                else if(is_loop_marker(data, cursor, mlen, "loopend")) { e.type="loop_end"; found = true; m_has_loop_end = true; }
+            } cursor += mlen;
+        } else if(st == 0xF0 || st == 0xF7) { auto l = Util::read_varlen(data, cursor); cursor = l.first + l.second; }
+        else {
+            e.cmd = st&0xF0; e.ch = st&0x0F;
+            if(e.cmd == 0x90) { e.type="note"; e.note=data[cursor++]; e.vel=data[cursor++]; if(e.vel==0) e.cmd=0x80; }
+            else if(e.cmd == 0x80) { e.type="note"; e.note=data[cursor++]; e.vel=0; cursor++; }
+            else if(e.cmd == 0xB0) { e.type="cc"; e.cc_val=data[cursor++]; e.val=data[cursor++]; if(e.cc_val == 111) e.type="loop_start"; }
+            else if(e.cmd == 0xC0) { e.type="prog"; e.val=data[cursor++]; }
+            else if(e.cmd == 0xE0) { 
+                // MIDI pitch bend is 14-bit (LSB + MSB), convert to 0-127 range for internal use
+                u8 lsb = data[cursor++]; 
+                u8 msb = data[cursor++]; 
+                int midiValue = lsb | (msb << 7);
+                e.type="pitch"; 
+                e.val = (midiValue * 127) / 16383;  // Convert back to 0-127 range
+            } else cursor++;
+            found = true;
+        }
+        if(found) trk.ev = e;
+    }
+    m_read += std::min(cursor, trk.end) - std::min(start, trk.end);
+    return found;
+}
+
+bool MidiEventCursor::next(SQEvent& ev) {
+    if(m_done) return false;
+    if(m_heap.empty()) {
+        // Every track has been read, so any loop end has been seen
+        ev = {0, m_has_loop_end ? "end" : "loop_end", 0,0,0,0};
+        m_done = true;
+        return true;
+    }
+    auto heap_order = [this](int a, int b) { return later(a, b); };
+    std::pop_heap(m_heap.begin(), m_heap.end(), heap_order);
+    Track& trk = m_tracks[m_heap.back()];
+    ev = trk.ev; ev.delta = (int)(trk.time - m_time); m_time = trk.time;
+    if(decode(trk)) std::push_heap(m_heap.begin(), m_heap.end(), heap_order);
+    else m_heap.pop_back();
+    return true;
+}
+
 bool MidiParser::load(const std::string& filename) {
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
     if(!file.is_open()) return false;
     data.resize(file.tellg()); file.seekg(0); file.read((char*)data.data(), data.size());
     if(data.size() < 14 || std::memcmp(data.data(), "MThd", 4) != 0) return false;
-    parse_midi(); return true;
-}
-
-void MidiParser::parse_midi() {
-    events.clear(); 
-    u16 num_trks_local = Util::readU16BE(data, 10); 
     ticks_per_quarter = Util::readU16BE(data, 12);
     if(ticks_per_quarter & 0x8000) ticks_per_quarter = 480;
-    std::vector<AbsEvent> all; size_t cursor = 14;
+    return true;
+}
 
-    for(int t=0; t<num_trks_local; t++) {
-        if(cursor+8 > data.size()) break; if(std::memcmp(data.data()+cursor, "MTrk", 4)!=0) break;
-        u32 len = Util::readU32BE(data, cursor+4); cursor += 8; size_t end = cursor + len;
-        u32 cur_time = 0; u8 running = 0;
-        while(cursor < end && cursor < data.size()) {
-            auto res = Util::read_varlen(data, cursor); cur_time += res.first; cursor = res.second; if(cursor>=data.size()) break;
-            u8 st = data[cursor]; if(st >= 0x80) { cursor++; if(st < 0xF0) running = st; } else st = running;
-            if(st == 0xFF) {
-                u8 type = data[cursor++]; auto lenRes = Util::read_varlen(data, cursor); size_t mlen = lenRes.first; cursor = lenRes.second;
-                if(type == 0x51 && mlen==3) {
-                    u32 mpqn = (data[cursor]<<16)|(data[cursor+1]<<8)|data[cursor+2];
-                    SQEvent e; e.type="tempo"; e.val = (int)(60000000.0/mpqn); all.push_back({cur_time, e});
-                } cursor += mlen;
-            } else if(st == 0xF0 || st == 0xF7) { auto l = Util::read_varlen(data, cursor); cursor = l.first + l.second; }
-            else {
-                SQEvent e; e.cmd = st&0xF0; e.ch = st&0x0F;
-                if(e.cmd == 0x90) { e.type="note"; e.note=data[cursor++]; e.vel=data[cursor++]; if(e.vel==0) e.cmd=0x80; }
-                else if(e.cmd == 0x80) { e.type="note"; e.note=data[cursor++]; e.vel=0; cursor++; }
-                else if(e.cmd == 0xB0) { e.type="cc"; e.cc_val=data[cursor++]; e.val=data[cursor++]; }
-                else if(e.cmd == 0xC0) { e.type="prog"; e.val=data[cursor++]; }
-                else if(e.cmd == 0xE0) { 
-                    // MIDI pitch bend is 14-bit (LSB + MSB), convert to 0-127 range for internal use
-                    u8 lsb = data[cursor++]; 
-                    u8 msb = data[cursor++]; 
-                    int midiValue = lsb | (msb << 7);
-                    e.type="pitch"; 
-                    e.val = (midiValue * 127) / 16383;  // Convert back to 0-127 range
-                } else cursor++;
-                all.push_back({cur_time, e});
-            }
-        }
-        cursor = end;
-    }
-    std::stable_sort(all.begin(), all.end());
-    u32 prev = 0; for(const auto& ae : all) { SQEvent e = ae.ev; e.delta = ae.abs_time - prev; events.push_back(e); prev = ae.abs_time; }
-    events.push_back({0, "loop_end", 0,0,0,0});
+std::unique_ptr<EventCursor> MidiParser::events() const {
+    return std::make_unique<MidiEventCursor>(data);
 }
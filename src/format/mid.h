@@ -9,8 +9,8 @@ class MidiParser : public SeqInterface {
     std::vector<u8> data;
 public:
     bool load(const std::string& filename) override;
-private:
-    void parse_midi();
+    // Merges the tracks as it goes, so only one pending event per track is held
+    std::unique_ptr<EventCursor> events() const override;
 };
 
 bool SaveSQToMidi(const std::vector<u8>& sqData, const std::string& filename);
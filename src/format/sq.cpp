@@ -1,6 +1,7 @@
 #include "sq.h"
 #include <fstream>
 #include <iostream>
+#include <algorithm>
 
 bool SQParser::load(const std::string& filename) {
     std::ifstream file(filename, std::ios::binary | std::ios::ate);
@@ -22,33 +23,61 @@ bool SQParser::load(const std::string& filename) {
         channel_inits[i] = init;
         ch_off += 16;
     }
-    parse_events();
     return true;
 }
 
-void SQParser::parse_events() {
-    events.clear(); size_t cursor = 0x110; int running_status = 0;
-    while (cursor < data.size()) {
+// Decodes straight from the file data, one event per call
+class SQEventCursor : public EventCursor {
+public:
+    explicit SQEventCursor(const std::vector<u8>& data) : m_data(data) {}
+    bool next(SQEvent& ev) override;
+    std::unique_ptr<EventCursor> clone() const override { return std::make_unique<SQEventCursor>(*this); }
+    size_t bytes_read() const override { return std::min(m_cursor, m_data.size()); }
+    size_t bytes_total() const override { return m_data.size(); }
+
+private:
+    const std::vector<u8>& m_data;
+    size_t m_cursor = 0x110;
+    int m_running_status = 0;
+    bool m_has_loop_end = false;
+    bool m_done = false;
+};
+
+bool SQEventCursor::next(SQEvent& ev) {
+    const auto& data = m_data; size_t& cursor = m_cursor;
+    while (!m_done && cursor < data.size()) {
         auto res = Util::read_varlen(data, cursor); int delta = res.first; cursor = res.second;
         if (cursor >= data.size()) break;
         u8 byte = data[cursor]; int status;
-        if (byte >= 0x80) { status = byte; cursor++; if (status < 0xF0) running_status = status; } else status = running_status;
+        if (byte >= 0x80) { status = byte; cursor++; if (status < 0xF0) m_running_status = status; } else status = m_running_status;
         int cmd = status & 0xF0; int ch = status & 0x0F;
-        if (cmd == 0x80 || cmd == 0x90) { int note = data[cursor++]; int vel = data[cursor++]; events.push_back({delta, "note", cmd, ch, note, vel}); }
-        else if (cmd == 0xB0) { int cc = data[cursor++]; int val = data[cursor++]; events.push_back({delta, "cc", cmd, ch, 0, 0, val, cc}); }
-        else if (cmd == 0xC0) { int val = data[cursor++]; events.push_back({delta, "prog", cmd, ch, 0, 0, val}); }
-        else if (cmd == 0xE0) { int val = data[cursor++]; events.push_back({delta, "pitch", cmd, ch, 0, 0, val}); }
+        if (cmd == 0x80 || cmd == 0x90) { int note = data[cursor++]; int vel = data[cursor++]; ev = {delta, "note", cmd, ch, note, vel}; return true; }
+        else if (cmd == 0xB0) {
+            int cc = data[cursor++]; int val = data[cursor++];
+            // NRPN 20/30 are the driver's loop start/end markers
+            if (cc == 99 && val == 20) ev = {delta, "loop_start", cmd, ch, 0, 0, val, cc};
+            else if (cc == 99 && val == 30) { ev = {delta, "loop_end", cmd, ch, 0, 0, val, cc}; m_has_loop_end = true; }
+            else ev = {delta, "cc", cmd, ch, 0, 0, val, cc};
+            return true;
+        }
+        else if (cmd == 0xC0) { int val = data[cursor++]; ev = {delta, "prog", cmd, ch, 0, 0, val}; return true; }
+        else if (cmd == 0xE0) { int val = data[cursor++]; ev = {delta, "pitch", cmd, ch, 0, 0, val}; return true; }
         else if (cmd == 0xF0) {
             if (status == 0xFF) {
                 int meta = data[cursor++];
-                if (meta == 0x2F) { events.push_back({delta, "loop_end", 0,0,0,0}); break; }
+                // Without explicit markers the whole track loops
+                if (meta == 0x2F) { ev = {delta, m_has_loop_end ? "end" : "loop_end", 0,0,0,0}; m_done = true; return true; }
                 else if (meta == 0x51) {
                     int len = data[cursor++];
-                    if (len == 3) { u32 mpqn = (data[cursor]<<16)|(data[cursor+1]<<8)|data[cursor+2]; cursor+=3; events.push_back({delta, "tempo", 0,0,0,0, (int)(60000000.0/mpqn)}); } else cursor += len;
+                    if (len == 3) { u32 mpqn = (data[cursor]<<16)|(data[cursor+1]<<8)|data[cursor+2]; cursor+=3; ev = {delta, "tempo", 0,0,0,0, (int)(60000000.0/mpqn), (int)mpqn}; return true; } else cursor += len;
                 } else { int len = data[cursor++]; cursor += len; }
             } else { int len = data[cursor++]; cursor += len; }
         } else cursor++;
     }
+    m_done = true;
+    return false;
 }
 
-
+std::unique_ptr<EventCursor> SQParser::events() const {
+    return std::make_unique<SQEventCursor>(data);
+}
@@ -5,7 +5,9 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <memory>
 
+// Tempo events carry the bpm in val and the exact microseconds per quarter in cc_val
 struct SQEvent { 
     int delta; 
     std::string type; 
@@ -14,13 +16,27 @@ struct SQEvent {
     bool operator<(const SQEvent& o) const { return false; } // Dummy
 };
 
+// Reads a sequence's events in play order, decoding each one only when it's asked for.
+// A clone carries on from the same point, which is how loops and checkpoints rewind.
+class EventCursor {
+public:
+    virtual ~EventCursor() = default;
+    // False once the events run out
+    virtual bool next(SQEvent& ev) = 0;
+    virtual std::unique_ptr<EventCursor> clone() const = 0;
+    // Event data consumed so far and in total, for progress
+    virtual size_t bytes_read() const = 0;
+    virtual size_t bytes_total() const = 0;
+};
+
 class SeqInterface {
 public:
-    std::vector<SQEvent> events;
     std::map<int, SQChannelInit> channel_inits;
     float tempo_bpm = 120.0f;
     int ticks_per_quarter = 480;
     virtual bool load(const std::string& filename) = 0;
+    // A cursor at the first event, valid while the sequence stays loaded
+    virtual std::unique_ptr<EventCursor> events() const = 0;
     virtual ~SeqInterface() = default;
 };
 
@@ -28,9 +44,8 @@ class SQParser : public SeqInterface {
     std::vector<u8> data;
 public:
     bool load(const std::string& filename) override;
+    std::unique_ptr<EventCursor> events() const override;
     const std::vector<u8>& getData() const { return data; }
-private:
-    void parse_events();
 };
 
 #endif // SQ_H
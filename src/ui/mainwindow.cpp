@@ -10,6 +10,7 @@
 #include "../format/mid.h"
 #include "../exporters/sf2exporter.h"
 #include "../exporters/renderwav.h"
+#include "../exporters/seqstats.h"
 #include "../common.h"
 
 #include <QFileDialog>
@@ -20,6 +21,7 @@
 #include <QScrollBar>
 #include <QRegularExpression>
 #include <algorithm>
+#include <thread>
 
 MainWindow::MainWindow(QWidget *parent)
 : QMainWindow(parent)
@@ -63,6 +65,7 @@ MainWindow::MainWindow(QWidget *parent)
         connect(ui->btnRenderWav, &QPushButton::clicked, this, &MainWindow::onRenderWav);
         connect(ui->btnBulk, &QPushButton::clicked, this, &MainWindow::onBulkExport);
         connect(ui->btnSeq2Midi, &QPushButton::clicked, this, &MainWindow::onSeq2Midi);
+        connect(ui->btnSeqStats, &QPushButton::clicked, this, &MainWindow::onSeqStats);
 
         QTimer::singleShot(500, this, [this](){
             log("Ready. Audio engine initialized.");
@@ -118,12 +121,16 @@ void MainWindow::onOpenHd() {
         log("Loaded BD: " + bdPath);
     }
 
+    m_cache.close();
+    if (ui->chkBankCache->isChecked() && !m_bd->data.empty()) loadBankCache(base);
+
     fillTree();
     ui->statusbar->showMessage("Loaded: " + fi.fileName());
 }
 
 void MainWindow::onCloseFile() {
     m_audio->stop();
+    m_cache.close();
     m_hd->clear();
     m_bd->data.clear();
     ui->treeWidget->clear();
@@ -132,6 +139,23 @@ void MainWindow::onCloseFile() {
     log("Closed.");
 }
 
+// Uses <base>.apebank when it was made from the loaded HD and BD, else builds it first
+void MainWindow::loadBankCache(const QString& base) {
+    std::string cachePath = (base + BankCache::kExtension).toStdString();
+    u64 hash = BankCache::content_hash(m_hd->getData(), m_bd->data);
+    if (!m_cache.open(cachePath, hash)) {
+        log("Building bank cache: " + QString::fromStdString(cachePath));
+        int threads = (int)std::max(1u, std::thread::hardware_concurrency());
+        if (!BankCache::write(cachePath, m_hd.get(), m_bd.get(), threads) || !m_cache.open(cachePath, hash)) {
+            log("Warning: Bank cache could not be written, samples are decoded per render.");
+            return;
+        }
+    }
+    // Tables and samples then come from the same snapshot
+    m_cache.restore(*m_hd);
+    log(QString("Bank cache: %1 samples").arg(m_cache.sample_count()));
+}
+
 void MainWindow::fillTree() {
     ui->treeWidget->clear();
     ui->propTable->setRowCount(0);
@@ -208,6 +232,12 @@ void MainWindow::updatePropertyView(int pid, int tid) {
         addPropRow("Tone Index", QString::number(tid));
         addPropRow("Offset", QString("0x%1").arg(QString::number(t.bd_offset, 16).toUpper()));
         addPropRow("Key Range", QString("%1 - %2").arg(t.min_note).arg(t.max_note));
+        std::vector<KeyRange> runs = p->is_sfx ? std::vector<KeyRange>() : p->tone_key_runs(tid);
+        QStringList keys;
+        for (const KeyRange& r : runs) keys << QString("%1 - %2").arg(r.lo).arg(r.hi);
+        if (p->is_sfx) addPropRow("Sounding Keys", "SFX");
+        else if (!runs.empty()) addPropRow("Sounding Keys", keys.join(", "));
+        else addPropRow("Sounding Keys", "None (shadowed)");
         addPropRow("Root Key", QString::number(t.root_key));
         addPropRow("ADSR 1/2", QString("%1 / %2").arg(QString::number(t.adsr1, 16)).arg(QString::number(t.adsr2, 16)));
         addPropRow("Vol / Pan", QString("%1 / %2").arg(t.vol).arg(t.pan));
@@ -279,11 +309,24 @@ void MainWindow::playSample(int pid, int tid) {
         }
     };
 
-    addVoice(tid);
-
-    if (prog->is_layered && !prog->is_sfx) {
-        addVoice(tid + 1);
+    // Play every tone that sounds together with this one at its root key (or the first note it plays on)
+    std::vector<KeyRange> runs = prog->is_sfx ? std::vector<KeyRange>() : prog->tone_key_runs(tid);
+    bool inSpan = false;
+    if (!runs.empty()) {
+        int key = prog->tones[tid].root_key;
+        bool sounds = false;
+        for (const KeyRange& r : runs) sounds |= key >= r.lo && key <= r.hi;
+        if (!sounds) key = runs.front().lo;
+        const ToneSpan& span = prog->tones_for(key);
+        for (int i = span.first; i < span.first + span.count; i++) inSpan |= (prog->note_tones[i] == tid);
+        if (inSpan) {
+            addVoice(tid);
+            for (int i = span.first; i < span.first + span.count; i++) {
+                if (prog->note_tones[i] != tid) addVoice(prog->note_tones[i]);
+            }
+        }
     }
+    if (!inSpan) addVoice(tid);
 
     if (!requests.empty()) {
         m_audio->play(requests);
@@ -310,7 +353,7 @@ void MainWindow::onRenderWav() {
         return;
     }
 
-    QString wavPath = QFileDialog::getSaveFileName(this, "Save WAV", "", "WAV Files (*.wav)");
+    QString wavPath = QFileDialog::getSaveFileName(this, "Save Audio", "", "WAV Files (*.wav);;FLAC Files (*.flac)");
     if (wavPath.isEmpty()) return;
 
     log("Starting WAV Render...");
@@ -329,13 +372,44 @@ void MainWindow::onRenderWav() {
         QApplication::processEvents();
     };
 
+    RenderOptions options;
+    options.start_seconds = ui->spinStart->value();
+    options.end_seconds = ui->spinEnd->value();
+    options.loop_count = ui->spinLoops->value();
+    options.fade_seconds = ui->spinFade->value();
+    options.interpolation = static_cast<Interpolation>(ui->cbInterp->currentIndex());
+    options.sample_rate = ui->cbRate->currentText().toInt();
+    options.format = static_cast<SampleFormat>(ui->cbFormat->currentIndex());
+    options.pan_law = static_cast<PanLaw>(ui->cbPan->currentIndex());
+    options.cull_db = ui->chkCull->isChecked() ? -120.0 : 0.0;
+    options.threads = ui->chkAllCores->isChecked() ? 0 : 1;
+    options.bank_cache = &m_cache;
+    RenderStats stats;
+    options.stats = &stats;
+
     bool ok = ExportSequenceToWav(sqPath.toStdString(), wavPath.toStdString(),
                                   m_hd.get(), m_bd.get(),
-                                  ui->chkReverb->isChecked(), isMidi, progressFunc);
+                                  ui->chkReverb->isChecked(), isMidi, progressFunc, options);
 
     ui->btnRenderWav->setEnabled(true);
     ui->progressBar->setValue(ui->progressBar->maximum());
     log(ok ? "WAV Render Successful." : "WAV Render Failed.");
+    if (ok) {
+        log(QString("  Rendered in %1 s, %2 ns per voice-sample (%3: %4)")
+            .arg(stats.render_seconds, 0, 'f', 2)
+            .arg(stats.voice_samples ? stats.render_seconds * 1e9 / stats.voice_samples : 0.0, 0, 'f', 1)
+            .arg(ui->cbInterp->currentText()).arg(stats.voice_samples));
+        log(QString("  Stages: synthesis %1 s, reverb and mix %2 s, encode and write %3 s")
+            .arg(stats.synth_seconds, 0, 'f', 2).arg(stats.mix_seconds, 0, 'f', 2).arg(stats.write_seconds, 0, 'f', 2));
+        u64 voiceTotal = stats.voice_samples + stats.culled_samples;
+        log(QString("  Culled: %1% of voice-samples inaudible, %2 voices retired early")
+            .arg(voiceTotal ? 100.0 * stats.culled_samples / voiceTotal : 0.0, 0, 'f', 1).arg(stats.voices_retired));
+        u64 keyOns = stats.envelope_hits + stats.envelope_misses;
+        log(QString("  Samples: %1 preloaded (%2 KB)").arg(stats.samples_loaded).arg(stats.sample_bytes / 1024));
+        log(QString("  Envelope cache: %1 curves (%2 KB), %3% hit rate over %4 key-ons")
+            .arg(stats.envelope_curves).arg(stats.envelope_bytes / 1024)
+            .arg(keyOns ? 100.0 * stats.envelope_hits / keyOns : 0.0, 0, 'f', 1).arg(keyOns));
+    }
 }
 
 void MainWindow::onBulkExport() {
@@ -463,6 +537,56 @@ void MainWindow::onSeq2Midi() {
     }
 }
 
+void MainWindow::onSeqStats() {
+    QString inDir = QFileDialog::getExistingDirectory(this, "Input Folder (SQ/MIDI files)");
+    if (inDir.isEmpty()) return;
+    QString outPath = QFileDialog::getSaveFileName(this, "Save Statistics", inDir + "/sequences.json", "JSON Files (*.json)");
+    if (outPath.isEmpty()) return;
+
+    QDir dir(inDir);
+    QFileInfoList seqFiles = dir.entryInfoList({"*.sq", "*.SQ", "*.mid", "*.MID", "*.midi"}, QDir::Files);
+    if (seqFiles.empty()) {
+        log("No sequence files found.");
+        return;
+    }
+
+    std::vector<std::pair<double, std::string>> entries;
+    for (const QFileInfo& info : seqFiles) {
+        bool isMidi = info.suffix().startsWith("mid", Qt::CaseInsensitive);
+        std::unique_ptr<SeqInterface> seq;
+        if (isMidi) seq = std::make_unique<MidiParser>();
+        else seq = std::make_unique<SQParser>();
+        if (!seq->load(info.absoluteFilePath().toStdString())) {
+            log("  -> Failed to load " + info.fileName());
+            continue;
+        }
+
+        // Prefer the bank that belongs to the sequence, else whatever is open
+        HDParser pairedHd;
+        const HDParser* hd = m_hd->programs.empty() ? nullptr : m_hd.get();
+        QString base = info.absolutePath() + "/" + info.completeBaseName();
+        if (pairedHd.load((base + ".hd").toStdString()) || pairedHd.load((base + ".HD").toStdString())) hd = &pairedHd;
+
+        SequenceStats stats = AnalyzeSequence(seq.get(), hd);
+        entries.push_back({stats.duration_seconds, SequenceStatsToJson(stats, info.fileName().toStdString())});
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    QFile out(outPath);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        log("Error: Failed to write " + outPath);
+        return;
+    }
+    out.write("[\n");
+    for (size_t i = 0; i < entries.size(); i++) {
+        out.write(("  " + entries[i].second + (i + 1 < entries.size() ? ",\n" : "\n")).c_str());
+    }
+    out.write("]\n");
+
+    log(QString("Analyzed %1 sequences -> %2").arg(entries.size()).arg(outPath));
+}
+
 void MainWindow::onAbout() {
     QString aboutText = QString(
         "<h2>%1</h2>"
@@ -4,6 +4,7 @@
 #include <QMainWindow>
 #include <memory>
 #include "../engine/audio.h"
+#include "../engine/bankcache.h"
 #include "../format/hd.h"
 #include "../format/bd.h"
 
@@ -27,6 +28,7 @@ private slots:
     void onExportSf2();
     void onBulkExport();
     void onSeq2Midi();
+    void onSeqStats();
 
     void onPlayClicked();
     void onStopClicked();
@@ -42,11 +44,13 @@ private:
     void addPropRow(const QString& name, const QString& value);
     void updatePropertyView(int pid, int tid);
     void playSample(int pid, int tid);
+    void loadBankCache(const QString& base);
     void log(const QString& msg);
 
     Ui::MainWindow *ui;
     std::unique_ptr<HDParser> m_hd;
     std::unique_ptr<BDParser> m_bd;
+    BankCache m_cache;
     std::unique_ptr<AudioEngine> m_audio;
     WaveformWidget* m_waveform;
 };
@@ -0,0 +1,89 @@
+// Timing checks for Sequencer loop handling, run from ctest. Builds a small MIDI file with
+// explicit loop markers, a tempo change inside the loop and events after loop_end.
+//
+//   sequencer_checks
+
+#include "engine/sequencer.h"
+#include "format/mid.h"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+static int g_failures = 0;
+
+static void Check(bool ok, const char* what, unsigned long long got, unsigned long long want) {
+    if (ok) return;
+    g_failures++;
+    printf("FAIL %s: got %llu, want %llu\n", what, got, want);
+}
+
+static void PutVarLen(std::vector<u8>& out, u32 value) {
+    u8 bytes[5];
+    int n = 0;
+    do { bytes[n++] = value & 0x7F; value >>= 7; } while (value);
+    while (n > 1) out.push_back(bytes[--n] | 0x80);
+    out.push_back(bytes[0]);
+}
+
+static void PutEvent(std::vector<u8>& out, u32 delta, std::initializer_list<u8> bytes) {
+    PutVarLen(out, delta);
+    out.insert(out.end(), bytes);
+}
+
+static void PutMarker(std::vector<u8>& out, u32 delta, const std::string& text) {
+    PutVarLen(out, delta);
+    out.insert(out.end(), { 0xFF, 0x06, (u8)text.size() });
+    out.insert(out.end(), text.begin(), text.end());
+}
+
+// 480 ticks per quarter. 120 bpm up to loopStart at tick 480, a note, 240 bpm from tick 1440,
+// loopEnd at 1920, then a note off and the end of the track 480 ticks apart.
+// One pass of the loop takes 1.25 s once the tempo is put back at its start.
+static std::vector<u8> LoopedMidi() {
+    std::vector<u8> track;
+    PutEvent(track, 0, { 0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20 });
+    PutMarker(track, 480, "loopStart");
+    PutEvent(track, 480, { 0x90, 0x3C, 0x40 });
+    PutEvent(track, 480, { 0xFF, 0x51, 0x03, 0x03, 0xD0, 0x90 });
+    PutMarker(track, 480, "loopEnd");
+    PutEvent(track, 480, { 0x80, 0x3C, 0x00 });
+    PutEvent(track, 480, { 0xFF, 0x2F, 0x00 });
+
+    std::vector<u8> file = { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0x01, 0xE0, 'M', 'T', 'r', 'k' };
+    u32 size = (u32)track.size();
+    file.insert(file.end(), { (u8)(size >> 24), (u8)(size >> 16), (u8)(size >> 8), (u8)size });
+    file.insert(file.end(), track.begin(), track.end());
+    return file;
+}
+
+int main() {
+    std::string path = (std::filesystem::temp_directory_path() / "apeplayer_sequencer_checks.mid").string();
+    std::vector<u8> midi = LoopedMidi();
+    std::ofstream(path, std::ios::binary).write((const char*)midi.data(), midi.size());
+
+    MidiParser seq;
+    if (!seq.load(path)) {
+        printf("FAIL could not load %s\n", path.c_str());
+        return 1;
+    }
+
+    const u64 rate = 44100;
+    for (int loops = 1; loops <= 3; loops++) {
+        Sequencer sequencer(&seq, nullptr);
+        sequencer.set_sample_rate((int)rate);
+        sequencer.set_loop_count(loops);
+        for (int n = sequencer.advance(); n > 0; n = sequencer.advance()) sequencer.consume(n);
+
+        // 0.5 s intro and 1.25 s per pass; the note off after loopEnd still plays, 0.25 s later
+        u64 exit = rate / 2 + rate * 5 / 4 * loops;
+        Check(sequencer.left_loop(), "left the loop", sequencer.left_loop(), 1);
+        Check(sequencer.loop_exit_position() == exit, "loop exit position", sequencer.loop_exit_position(), exit);
+        Check(sequencer.position() >= exit + rate / 4, "end position", sequencer.position(), exit + rate / 4);
+    }
+
+    std::filesystem::remove(path);
+    if (g_failures == 0) printf("sequencer checks passed\n");
+    return g_failures == 0 ? 0 : 1;
+}